@@ -0,0 +1,95 @@
+#include <stdlib.h>
+#include "Arena.h"
+
+#ifdef WD2_ARENA_HUGE_PAGES
+#include <sys/mman.h>
+#endif
+
+#ifdef WD2_ARENA_HUGE_PAGES
+static const size_t ARENA_BLOCK_SIZE = 2 * 1024 * 1024;
+#else
+static const size_t ARENA_BLOCK_SIZE = 64 * 1024;
+#endif
+
+Arena::~Arena()
+{
+	for (size_t i = 0; i < blocks.size(); i++) {
+		freeBlock(blocks[i]);
+	}
+}
+
+Arena & Arena::current()
+{
+	static thread_local Arena arena;
+	return arena;
+}
+
+/**
+ * Move on to the next block, or insert a new one there if the next block is
+ * too small.
+ */
+void * Arena::allocateSlow(size_t size, size_t align)
+{
+	size_t next = ptr ? block + 1 : 0;
+	if (next >= blocks.size() || blocks[next].size < size + align) {
+		blocks.insert(blocks.begin() + next, newBlock(size + align));
+	}
+	block = next;
+	ptr = blocks[block].begin;
+	end = ptr + blocks[block].size;
+
+	char * p = (char*)(((uintptr_t)ptr + align - 1) & ~(uintptr_t)(align - 1));
+	ptr = p + size;
+	return p;
+}
+
+void Arena::rewind(size_t block_, char * ptr_)
+{
+	if (block_ == 0 && (!ptr_ || ptr_ == blocks[0].begin)) {
+		// Outermost scope: keep just the first block for next time
+		while (blocks.size() > 1) {
+			freeBlock(blocks.back());
+			blocks.pop_back();
+		}
+		if (blocks.size()) {
+			ptr_ = blocks[0].begin;
+		}
+	}
+	block = block_;
+	ptr = ptr_;
+	end = ptr ? blocks[block].begin + blocks[block].size : NULL;
+}
+
+Arena::Block Arena::newBlock(size_t minSize)
+{
+	Block b;
+	b.size = ARENA_BLOCK_SIZE;
+	while (b.size < minSize) {
+		b.size *= 2;
+	}
+#ifdef WD2_ARENA_HUGE_PAGES
+	void * p = mmap(NULL, b.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED) {
+		throw std::bad_alloc();
+	}
+#ifdef MADV_HUGEPAGE
+	madvise(p, b.size, MADV_HUGEPAGE);
+#endif
+#else
+	void * p = malloc(b.size);
+	if (!p) {
+		throw std::bad_alloc();
+	}
+#endif
+	b.begin = (char*)p;
+	return b;
+}
+
+void Arena::freeBlock(Block & b)
+{
+#ifdef WD2_ARENA_HUGE_PAGES
+	munmap(b.begin, b.size);
+#else
+	free(b.begin);
+#endif
+}
@@ -0,0 +1,99 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <new>
+#include <vector>
+
+/**
+ * A monotonic memory arena. Allocation bumps a pointer through a list of
+ * large blocks, and freeing is a no-op. Instead, memory is released all at
+ * once when a Scope ends, which rewinds the arena to where it was when the
+ * Scope began. Every container allocated from the arena inside a Scope must
+ * be destroyed before the Scope ends.
+ *
+ * Each thread has its own arena, so no locking is needed. The blocks come
+ * from malloc(), not from the PHP request pool, and are kept for reuse by
+ * later requests, apart from any beyond the first which are freed when the
+ * outermost Scope ends.
+ *
+ * If WD2_ARENA_HUGE_PAGES is defined, the blocks are 2MB, mapped with mmap()
+ * and marked for transparent huge pages.
+ */
+class Arena {
+	public:
+		class Scope {
+			public:
+				Scope() : arena(Arena::current()), block(arena.block), ptr(arena.ptr) {}
+				~Scope() { arena.rewind(block, ptr); }
+			protected:
+				Arena & arena;
+				size_t block;
+				char * ptr;
+		};
+
+		Arena() : block(0), ptr(NULL), end(NULL) {}
+		~Arena();
+
+		/** The calling thread's arena */
+		static Arena & current();
+
+		void * allocate(size_t size, size_t align) {
+			char * p = (char*)(((uintptr_t)ptr + align - 1) & ~(uintptr_t)(align - 1));
+			if (ptr && size <= (size_t)(end - p)) {
+				ptr = p + size;
+				return p;
+			}
+			return allocateSlow(size, align);
+		}
+
+	protected:
+		struct Block {
+			char * begin;
+			size_t size;
+		};
+
+		void * allocateSlow(size_t size, size_t align);
+		void rewind(size_t block_, char * ptr_);
+		Block newBlock(size_t minSize);
+		void freeBlock(Block & b);
+
+		// Uses std::allocator, since the arena outlives the request
+		std::vector<Block> blocks;
+		// The block being allocated from, and the free part of it
+		size_t block;
+		char * ptr;
+		char * end;
+};
+
+/**
+ * Allocation class which allocates from the calling thread's Arena. See
+ * the notes there about object lifetimes.
+ */
+template <class T>
+class ArenaAllocator : public std::allocator<T>
+{
+	public:
+		typedef typename std::allocator<T>::pointer pointer;
+		typedef typename std::allocator<T>::size_type size_type;
+
+		template <class U> struct rebind { typedef ArenaAllocator<U> other; };
+
+		ArenaAllocator() throw() {}
+		ArenaAllocator(const ArenaAllocator& other) throw() {}
+		template <class U> ArenaAllocator(const ArenaAllocator<U>&) throw() {}
+
+		pointer allocate(size_type size, typename std::allocator<void>::const_pointer hint = 0) {
+			if (size > (size_t)-1 / sizeof(T)) {
+				throw std::bad_alloc();
+			}
+			return (pointer)Arena::current().allocate(size * sizeof(T), alignof(T));
+		}
+
+		// Memory is released when the enclosing Arena::Scope ends
+		void deallocate(pointer p, size_type n) {}
+};
+
+#endif
@@ -0,0 +1,99 @@
+#include <algorithm>
+#include <list>
+#include "BatchDiff.h"
+#include "TableDiff.h"
+#include "InlineDiff.h"
+#include "EditScriptDiff.h"
+
+/**
+ * Output sink which appends to the result of a pair
+ */
+class PairOutputSink : public OutputSink {
+	public:
+		explicit PairOutputSink(std::string & result_) : result(result_) {}
+		void write(const char * data, size_t length) { result.append(data, length); }
+		void reserve(size_t length) { result.reserve(length); }
+	protected:
+		std::string & result;
+};
+
+void BatchDiff::execute(PairVector & pairs)
+{
+	if (!pool || pairs.size() < 2) {
+		diffRun(pairs, 0, pairs.size());
+		return;
+	}
+
+	size_t numRuns = std::min(pairs.size(), (size_t)(pool->size() + 1) * RUNS_PER_THREAD);
+	size_t runLength = (pairs.size() + numRuns - 1) / numRuns;
+	std::list<ThreadPool::TaskGroup> groups;
+	std::exception_ptr error;
+	try {
+		for (size_t start = 0; start < pairs.size(); start += runLength) {
+			size_t end = std::min(start + runLength, pairs.size());
+			groups.emplace_back();
+			pool->submit(groups.back(), [this, &pairs, start, end] {
+				diffRun(pairs, start, end);
+			});
+		}
+	} catch (...) {
+		error = std::current_exception();
+	}
+	// Wait for every run which was submitted, even after an error, so that
+	// none is left using the pairs
+	for (std::list<ThreadPool::TaskGroup>::iterator it = groups.begin(); it != groups.end(); ++it) {
+		try {
+			pool->wait(*it);
+		} catch (...) {
+			if (!error) {
+				error = std::current_exception();
+			}
+		}
+	}
+	if (error) {
+		std::rethrow_exception(error);
+	}
+}
+
+// Diff the pairs [start, end) with one formatter, which is created and
+// destroyed on the thread running the run, as its memory must be
+void BatchDiff::diffRun(PairVector & pairs, size_t start, size_t end)
+{
+	if (format == FORMAT_INLINE) {
+		InlineDiff wikidiff2;
+		diffRun(wikidiff2, pairs, start, end);
+	} else if (format == FORMAT_EDIT_SCRIPT) {
+		EditScriptDiff wikidiff2;
+		diffRun(wikidiff2, pairs, start, end);
+	} else {
+		TableDiff wikidiff2;
+		diffRun(wikidiff2, pairs, start, end);
+	}
+}
+
+void BatchDiff::diffRun(Wikidiff2 & wikidiff2, PairVector & pairs, size_t start, size_t end)
+{
+	wikidiff2.setAlgorithm(algorithm);
+	wikidiff2.setMaxWork(maxWork);
+	wikidiff2.setApproximateThreshold(approximateThreshold);
+	wikidiff2.setDetectMoves(detectMoves);
+	wikidiff2.setReuseLines(true);
+	for (size_t i = start; i < end; i++) {
+		Pair & pair = pairs[i];
+		PairOutputSink sink(pair.result);
+		ResultCache::Key key;
+		if (cache) {
+			key = cache->makeKey(pair.text1, pair.length1, pair.text2, pair.length2, format,
+				numContextLines, algorithm, maxWork, approximateThreshold, detectMoves);
+			if (cache->lookup(key, sink)) {
+				continue;
+			}
+		}
+		wikidiff2.setOutputSink(&sink);
+		wikidiff2.execute(pair.text1, pair.length1, pair.text2, pair.length2, numContextLines);
+		wikidiff2.setOutputSink(NULL);
+		if (cache) {
+			cache->store(key, pair.result.data(), pair.result.size());
+		}
+	}
+}
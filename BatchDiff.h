@@ -0,0 +1,85 @@
+#ifndef BATCHDIFF_H
+#define BATCHDIFF_H
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include "Wikidiff2.h"
+#include "ResultCache.h"
+
+/**
+ * Diffs a list of text pairs in one call, e.g. the consecutive revisions of
+ * a page for its history, rather than setting up a new diff for each pair.
+ *
+ * The pairs are split into runs of consecutive pairs, each diffed by one
+ * formatter, so that its engines and buffers are reused from one pair to the
+ * next. When a pair's first text is the same buffer as the previous pair's
+ * second text, the lines already split from it are reused. With a thread
+ * pool, the runs are diffed in parallel.
+ *
+ * The texts must stay valid until execute() returns.
+ */
+class BatchDiff {
+	public:
+		// Output formats, as for ResultCache
+		enum Format {
+			FORMAT_TABLE = ResultCache::FORMAT_TABLE,
+			FORMAT_INLINE = ResultCache::FORMAT_INLINE,
+			FORMAT_EDIT_SCRIPT = ResultCache::FORMAT_EDIT_SCRIPT
+		};
+
+		struct Pair {
+			Pair(const char * text1_, size_t length1_, const char * text2_, size_t length2_)
+				: text1(text1_), length1(length1_), text2(text2_), length2(length2_) {}
+			const char * text1;
+			size_t length1;
+			const char * text2;
+			size_t length2;
+			// The rendered diff, set by execute()
+			std::string result;
+		};
+		typedef std::vector<Pair> PairVector;
+
+		BatchDiff(Format format_, int numContextLines_)
+			: format(format_), numContextLines(numContextLines_),
+			algorithm(DIFF_ALGORITHM_DAIRIKI), maxWork(0), approximateThreshold(0),
+			detectMoves(false), pool(NULL), cache(NULL) {}
+
+		// These options apply to each pair, as the Wikidiff2 setters do. The
+		// work limit is for each pair separately.
+		void setAlgorithm(DiffAlgorithm algorithm_) { algorithm = algorithm_; }
+		void setMaxWork(long long maxWork_) { maxWork = maxWork_; }
+		void setApproximateThreshold(int threshold) { approximateThreshold = threshold; }
+		void setDetectMoves(bool detectMoves_) { detectMoves = detectMoves_; }
+
+		// Diff runs of pairs in parallel on the given pool. NULL means serial.
+		void setThreadPool(ThreadPool * pool_) { pool = pool_; }
+
+		// Look up each pair in the given result cache before diffing it, and
+		// store the result after. NULL means no cache.
+		void setResultCache(ResultCache * cache_) { cache = cache_; }
+
+		// Diff all the pairs, setting their results
+		void execute(PairVector & pairs);
+
+	protected:
+		enum {
+			// Runs per pool thread, so that the load stays balanced when the
+			// pairs differ in size
+			RUNS_PER_THREAD = 4
+		};
+
+		void diffRun(PairVector & pairs, size_t start, size_t end);
+		void diffRun(Wikidiff2 & wikidiff2, PairVector & pairs, size_t start, size_t end);
+
+		Format format;
+		int numContextLines;
+		DiffAlgorithm algorithm;
+		long long maxWork;
+		int approximateThreshold;
+		bool detectMoves;
+		ThreadPool * pool;
+		ResultCache * cache;
+};
+
+#endif
@@ -0,0 +1,116 @@
+#include "Blame.h"
+
+void Blame::addRevision(const char * text_, size_t length_)
+{
+	int revision = numRevisions++;
+	newLines.clear();
+	newWords.clear();
+	newLineWords.assign(1, 0);
+	newOrigins.clear();
+	Wikidiff2::explodeLines(text_, text_ + length_, newLines);
+
+	if (revision == 0) {
+		addLines(0, (int)newLines.size());
+	} else {
+		LineDiff linediff(lines, newLines, 0, algorithm, NULL, false, NULL, &lineEngine);
+		for (unsigned i = 0; i < linediff.size(); ++i) {
+			DiffOp<Line> & op = linediff[i];
+			switch (op.op) {
+				case DiffOp<Line>::copy:
+					// The lines are unchanged, so they keep their origins
+					for (int j = 0; j < op.from.size(); j++) {
+						int from = op.from.start + j;
+						if (level == LEVEL_LINE) {
+							newOrigins.push_back(origins[from]);
+							continue;
+						}
+						// Move the words over to the line in the new text
+						ptrdiff_t shift = newLines[op.to.start + j].start - lines[from].start;
+						for (int k = lineWords[from]; k < lineWords[from + 1]; k++) {
+							const Word & word = words[k];
+							newWords.push_back(Word(word.bodyStart + shift, word.bodyEnd + shift,
+								word.suffixEnd + shift));
+							newOrigins.push_back(origins[k]);
+						}
+						newLineWords.push_back((int)newWords.size());
+					}
+					break;
+				case DiffOp<Line>::add:
+					addLines(op.to.start, op.to.start + op.to.size());
+					break;
+				case DiffOp<Line>::change:
+					if (level == LEVEL_WORD) {
+						diffChangedWords(op);
+					} else {
+						addLines(op.to.start, op.to.start + op.to.size());
+					}
+					break;
+			}
+		}
+	}
+
+	text = text_;
+	length = length_;
+	lines.swap(newLines);
+	words.swap(newWords);
+	lineWords.swap(newLineWords);
+	origins.swap(newOrigins);
+}
+
+// Add the new lines [start, end), as added in the new revision
+void Blame::addLines(int start, int end)
+{
+	int revision = numRevisions - 1;
+	for (int i = start; i < end; i++) {
+		if (level == LEVEL_LINE) {
+			newOrigins.push_back(revision);
+			continue;
+		}
+		Wikidiff2::explodeWords(newLines[i], newWords);
+		newOrigins.resize(newWords.size(), revision);
+		newLineWords.push_back((int)newWords.size());
+	}
+}
+
+// Find the origins of the words of the new lines of a change, by diffing
+// them with the words of the old lines, taken as one sequence each
+void Blame::diffChangedWords(const DiffOp<Line> & op)
+{
+	changeWords1.assign(words.begin() + lineWords[op.from.start],
+		words.begin() + lineWords[op.from.start + op.from.size()]);
+	size_t firstWord = newWords.size();
+	int firstOrigin = lineWords[op.from.start];
+	for (int j = 0; j < op.to.size(); j++) {
+		Wikidiff2::explodeWords(*op.to[j], newWords);
+		newLineWords.push_back((int)newWords.size());
+	}
+	changeWords2.assign(newWords.begin() + firstWord, newWords.end());
+
+	int revision = numRevisions - 1;
+	WordDiff worddiff(changeWords1, changeWords2, MAX_WORD_DIFF_COMPLEXITY, algorithm, NULL,
+		false, NULL, &wordEngine);
+	for (unsigned i = 0; i < worddiff.size(); ++i) {
+		DiffOp<Word> & wordOp = worddiff[i];
+		if (wordOp.op == DiffOp<Word>::copy) {
+			for (int k = 0; k < wordOp.from.size(); k++) {
+				newOrigins.push_back(origins[firstOrigin + wordOp.from.start + k]);
+			}
+		} else if (wordOp.op == DiffOp<Word>::add || wordOp.op == DiffOp<Word>::change) {
+			newOrigins.resize(newOrigins.size() + wordOp.to.size(), revision);
+		}
+	}
+}
+
+void Blame::getOffsets(IndexVector & offsets) const
+{
+	offsets.clear();
+	if (level == LEVEL_LINE) {
+		for (size_t i = 0; i < lines.size(); i++) {
+			offsets.push_back((int)(lines[i].start - text));
+		}
+	} else {
+		for (size_t i = 0; i < words.size(); i++) {
+			offsets.push_back((int)(words[i].bodyStart - text));
+		}
+	}
+}
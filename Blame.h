@@ -0,0 +1,99 @@
+#ifndef BLAME_H
+#define BLAME_H
+
+#include <stddef.h>
+#include <vector>
+#include "Wikidiff2.h"
+
+/**
+ * Finds the revision which added each line or word of a page, given its
+ * revisions in order, oldest first.
+ *
+ * Each revision is diffed against the one before it, and the origin of each
+ * line or word is carried forward through the copied parts, while the added
+ * and changed parts get the new revision as their origin. At word level,
+ * copied lines keep the origins of all their words, and only the lines of a
+ * change are split into words and word-diffed.
+ *
+ * Each revision is split into lines and words once, when it is added, and
+ * then serves as the old side of the next diff, so following a chain costs
+ * about half as much as diffing each pair separately.
+ */
+class Blame {
+	public:
+		typedef Wikidiff2::LineVector LineVector;
+		typedef Wikidiff2::WordVector WordVector;
+		typedef Wikidiff2::IndexVector IndexVector;
+		typedef Diff<Line> LineDiff;
+		typedef Diff<Word> WordDiff;
+
+		// The unit which origins are found for
+		enum Level { LEVEL_LINE = 0, LEVEL_WORD = 1 };
+
+		explicit Blame(Level level_)
+			: level(level_), algorithm(DIFF_ALGORITHM_DAIRIKI), numRevisions(0),
+			text(NULL), length(0) {}
+
+		// Select the algorithm used for the line and word diffs
+		void setAlgorithm(DiffAlgorithm algorithm_) { algorithm = algorithm_; }
+
+		/**
+		 * Add the next revision. Its text is not copied, and must stay valid
+		 * until the revision after it has been added, or for as long as
+		 * getOffsets() is used if it is the last.
+		 */
+		void addRevision(const char * text_, size_t length_);
+
+		/** The number of revisions added so far */
+		int size() const { return numRevisions; }
+
+		/**
+		 * Get the lines or words of the last revision, as the byte offset at
+		 * which each starts. Each runs up to the start of the next.
+		 */
+		void getOffsets(IndexVector & offsets) const;
+
+		/**
+		 * The index of the revision which added each line or word of the
+		 * last revision, counting from zero
+		 */
+		const IndexVector & getOrigins() const { return origins; }
+
+	protected:
+		enum {
+			// Complexity limit of the word diff of a change, as for the
+			// word diffs of a rendered diff
+			MAX_WORD_DIFF_COMPLEXITY = 40000000
+		};
+
+		void addLines(int start, int end);
+		void diffChangedWords(const DiffOp<Line> & op);
+
+		Level level;
+		DiffAlgorithm algorithm;
+		int numRevisions;
+
+		// The last revision, and the origin of each of its lines or words.
+		// At word level, the words of line i are words[lineWords[i] ...
+		// lineWords[i + 1]).
+		const char * text;
+		size_t length;
+		LineVector lines;
+		WordVector words;
+		IndexVector lineWords;
+		IndexVector origins;
+
+		// The same for the revision being added
+		LineVector newLines;
+		WordVector newWords;
+		IndexVector newLineWords;
+		IndexVector newOrigins;
+
+		// Words of one change, to be diffed
+		WordVector changeWords1, changeWords2;
+
+		DiffEngine<Line> lineEngine;
+		DiffEngine<Word> wordEngine;
+};
+
+#endif
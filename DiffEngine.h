@@ -5,25 +5,108 @@
 #ifndef DIFFENGINE_H
 #define DIFFENGINE_H
 
-//#define USE_JUDY
-
 #include <vector>
-#include <map>
-#include <set>
 #include <utility>
 #include <algorithm>
 #include <cassert>
-
-#ifdef USE_JUDY
-#include "JudyHS.h"
-#endif
+#include <climits>
+#include <stdint.h>
+#include <atomic>
 
 #include "Wikidiff2.h"
+#include "ThreadPool.h"
+
+/**
+ * 32-bit FNV-1a hash of a byte sequence
+ */
+template<typename InputIterator>
+inline uint32_t diffHashBytes(InputIterator begin, InputIterator end)
+{
+	uint32_t h = 2166136261U;
+	for (; begin != end; ++begin) {
+		h ^= (unsigned char)*begin;
+		h *= 16777619U;
+	}
+	return h;
+}
+
+/**
+ * Hash function used by DiffEngine to intern its input. Values which compare
+ * equal must have the same hash. The default works for string types; other
+ * token types specialise it (see Word.h).
+ */
+template<typename T>
+struct DiffHash
+{
+	uint32_t operator()(const T & value) const {
+		return diffHashBytes(value.begin(), value.end());
+	}
+};
+
+/**
+ * Algorithms DiffEngine can use to find the longest common subsequence
+ *
+ *    DIFF_ALGORITHM_DAIRIKI:  Algorithm::Diff style, time depends on the number of
+ *                             matching line pairs. This is the default.
+ *    DIFF_ALGORITHM_MYERS:    Myers' O((N+M)D) algorithm in linear space, time depends
+ *                             on the size D of the edit. Fast for small edits.
+ */
+enum DiffAlgorithm {
+	DIFF_ALGORITHM_DAIRIKI = 0,
+	DIFF_ALGORITHM_MYERS = 1
+};
+
+/**
+ * A limit on the work done by DiffEngine, which may be shared by several
+ * diffs. Work is counted in steps of the innermost loops of the LCS search.
+ * When the limit is reached, the parts of the LCS which have not yet been
+ * found are reported as changed, so the result is still a valid diff, just a
+ * coarser one. A limit of zero means no limit.
+ */
+class DiffBudget
+{
+	public:
+		DiffBudget(long long limit_ = 0) : limit(limit_), used(0) {}
+
+		void spend(long long work) {
+			if (limit > 0)
+				used.fetch_add(work, std::memory_order_relaxed);
+		}
+		bool exhausted() const {
+			return limit > 0 && used.load(std::memory_order_relaxed) >= limit;
+		}
+
+		long long limit;
+		// Atomic, since a parallel diff spends from several threads
+		std::atomic<long long> used;
+};
+
+/**
+ * A run of consecutive elements of one of the input vectors of a diff,
+ * given as an offset and length. Indexing it gives a pointer to the element,
+ * so it can be used much like a vector of pointers, without storing one.
+ */
+template<typename T>
+class DiffRange
+{
+	public:
+		DiffRange() : values(NULL), start(0), len(0) {}
+		DiffRange(const T * values_, int start_, int len_)
+			: values(values_), start(start_), len(len_) {}
+
+		int size() const { return len; }
+		bool empty() const { return len == 0; }
+		const T * operator[](int i) const { return values + start + i; }
+
+		const T * values;
+		int start;
+		int len;
+};
 
 /**
  * Diff operation
  *
- * from and to are vectors containing pointers to the objects passed in from_lines and to_lines
+ * from and to are ranges of the objects passed in from_lines and to_lines
  *
  * op is one of the following
  *    copy:    A sequence of lines (in from and to) which are the same in both files.
@@ -37,29 +120,40 @@ template<typename T>
 class DiffOp
 {
 	public:
-		typedef std::vector<const T*, WD2_ALLOCATOR<const T*> > PointerVector;
-		DiffOp(int op_, const PointerVector & from_, const PointerVector & to_)
+		typedef DiffRange<T> Range;
+		DiffOp(int op_, const Range & from_, const Range & to_)
 			: op(op_), from(from_), to(to_) {}
 
 		enum {copy, del, add, change};
 		int op;
-		PointerVector from;
-		PointerVector to;
+		Range from;
+		Range to;
 };
 
+template<typename T>
+class DiffEngine;
+
 /**
  * Basic diff template class. After construction, edits will contain a vector of DiffOpTemplate
  * objects representing the diff
+ *
+ * An engine may be passed in, so that its working storage is reused from one
+ * diff to the next. It must not be used by two diffs at the same time.
  */
 template<typename T>
 class Diff
 {
 	public:
 		typedef std::vector<T, WD2_ALLOCATOR<T> > ValueVector;
-		typedef std::vector<DiffOp<T>, WD2_ALLOCATOR<T> > DiffOpVector;
+		typedef std::vector<DiffOp<T>, WD2_ALLOCATOR<DiffOp<T> > > DiffOpVector;
 
 		Diff(const ValueVector & from_lines, const ValueVector & to_lines,
-			long long bailoutComplexity = 0);
+			long long bailoutComplexity = 0, DiffAlgorithm algorithm = DIFF_ALGORITHM_DAIRIKI,
+			DiffBudget * budget = NULL, bool approximate = false,
+			ThreadPool * pool = NULL, DiffEngine<T> * engine = NULL);
+
+		// An empty diff, to which edits found elsewhere can be added
+		Diff() {}
 
 		virtual void add_edit(const DiffOp<T> & edit) {
 			edits.push_back(edit);
@@ -88,6 +182,21 @@ class Diff
  *
  * Finally, it was ported to C++ by Tim Starling in February 2006
  *
+ * Alternatively, the LCS can be found with the linear-space variant of the
+ * algorithm described in E. Myers, "An O(ND) Difference Algorithm and Its
+ * Variations", Algorithmica 1 (1986), as also used by GNU diffutils.
+ *
+ * For very large inputs there is also an approximate mode, which anchors
+ * on lines that occur once on each side, and only runs the exact algorithm
+ * in the small gaps between anchors.
+ *
+ * Given a ThreadPool, the subproblems which compareseq() splits a large
+ * problem into are solved in parallel. The result is the same as when
+ * running serially.
+ *
+ * Before the LCS is computed, every input line is interned to a dense integer
+ * ID, so the algorithm itself only ever compares integers.
+ *
  * @access private
  */
 
@@ -97,47 +206,99 @@ class DiffEngine
 	public:
 		// Vectors
 		typedef std::vector<bool> BoolVector; // skip the allocator here to get the specialisation
+		// One byte per flag, so that flags can be set from several threads at once
+		typedef std::vector<char, WD2_ALLOCATOR<char> > FlagVector;
 		typedef std::vector<const T*, WD2_ALLOCATOR<const T*> > PointerVector;
 		typedef std::vector<T, WD2_ALLOCATOR<T> > ValueVector;
 		typedef std::vector<int, WD2_ALLOCATOR<int> > IntVector;
+		typedef std::vector<uint32_t, WD2_ALLOCATOR<uint32_t> > IdVector;
 		typedef std::vector<std::pair<int, int>, WD2_ALLOCATOR<std::pair<int, int> > > IntPairVector;
+		typedef typename DiffOp<T>::Range Range;
 
-		// Maps
-#ifdef USE_JUDY
-		typedef JudyHS<IntVector> MatchesMap;
-#else
-		typedef std::map<T, IntVector, std::less<T>, WD2_ALLOCATOR<IntVector> > MatchesMap;
-#endif
-
-		// Sets
-		typedef std::set<int, std::less<int>, WD2_ALLOCATOR<int> > IntSet;
-#ifdef USE_JUDY
-		typedef JudySet ValueSet;
-#else
-		typedef std::set<T, std::less<T>, WD2_ALLOCATOR<T> > ValueSet;
-#endif
-
-		DiffEngine() : done(false) {}
+		DiffEngine() : budget(NULL), algorithm(DIFF_ALGORITHM_DAIRIKI), pool(NULL),
+			done(false) {}
 		void clear();
 		void diff (const ValueVector & from_lines,
 				const ValueVector & to_lines, Diff<T> & diff,
-				long long bailoutComplexity = 0);
-		int lcs_pos (int ypos);
+				long long bailoutComplexity = 0,
+				DiffAlgorithm algorithm = DIFF_ALGORITHM_DAIRIKI,
+				DiffBudget * budget = NULL,
+				bool approximate = false,
+				ThreadPool * pool = NULL);
 		void compareseq (int xoff, int xlim, int yoff, int ylim);
-		void shift_boundaries (const ValueVector & lines, BoolVector & changed,
-				const BoolVector & other_changed);
+		void myers_compareseq (int xoff, int xlim, int yoff, int ylim);
+		void anchored_compareseq (int xoff, int xlim, int yoff, int ylim, int depth);
+		void shift_boundaries (const IdVector & lines, FlagVector & changed,
+				const FlagVector & other_changed);
 	protected:
-		int diag (int xoff, int xlim, int yoff, int ylim, int nchunks,
-				IntPairVector & seps);
+		typedef std::pair<int, int> IntPair;
+
+		/**
+		 * Working state of diag(). When running in parallel, each thread has
+		 * its own, and may need to grow it. So it uses std::allocator, since
+		 * PhpAllocator may only be used from the PHP thread.
+		 */
+		struct DiagScratch {
+			DiagScratch() : lcs(0) {}
+			std::vector<int> seq;
+			// Flags the y positions currently in seq[1..lcs]
+			std::vector<bool> in_seq;
+			// 2-d array, line major, chunk minor
+			std::vector<int> ymids;
+			int lcs;
+		};
+		typedef std::vector<DiagScratch> DiagScratchVector;
 
-		BoolVector xchanged, ychanged;
-		PointerVector xv, yv;
+		int diag (int xoff, int xlim, int yoff, int ylim, int nchunks,
+				IntPair * seps, DiagScratch & scratch);
+		int lcs_pos (int ypos, DiagScratch & scratch);
+		bool myers_split (int xoff, int xlim, int yoff, int ylim,
+				int & xmid, int & ymid);
+		inline bool out_of_budget() const;
+		void intern (const ValueVector & from_lines, const ValueVector & to_lines);
+		void intern_lines (const ValueVector & lines, IdVector & ids);
+		void build_match_index (const IdVector & v, IntVector & start, IntVector & pos);
+		void find_anchors (int xoff, int xlim, int yoff, int ylim, IntPairVector & anchors);
+
+		// Token IDs of from_lines and to_lines
+		IdVector xids, yids;
+		// Open-addressed hash table of IDs, and the hash and first value of each ID
+		IdVector id_table, id_hashes;
+		PointerVector id_values;
+
+		FlagVector xchanged, ychanged;
+		// Token IDs occurring in the middle of from_lines and to_lines
+		BoolVector xhash, yhash;
+		IdVector xv, yv;
 		IntVector xind, yind;
-		IntVector seq;
-		IntSet in_seq;
-		int lcs;
+		// Scratch space for diag(), one per thread: index 0 for the calling
+		// thread, and the rest indexed by ThreadPool::currentWorker(). Other
+		// threads outside the pool never run this engine's tasks.
+		DiagScratchVector diag_scratch;
+		// Positions of each token ID in xv and yv, in ascending order. The
+		// positions of ID i are {x,y}match_pos[{x,y}match_start[i] ...
+		// {x,y}match_start[i+1]).
+		IntVector xmatch_start, xmatch_pos, ymatch_start, ymatch_pos;
+		// Scratch space for build_match_index()
+		IntVector match_fill;
+		// Scratch space for find_anchors(): occurrence counts of each token ID,
+		// and the position of its last occurrence in yv
+		IntVector xcount, ycount, ypos;
+		// Furthest reaching paths of the Myers search, indexed by diagonal
+		IntVector fdiag, bdiag;
+		int diag_offset;
+		DiffBudget * budget;
+		DiffAlgorithm algorithm;
+		ThreadPool * pool;
 		bool done;
 		enum {MAX_CHUNKS=8};
+		// Subproblems with at least this many lines are run as parallel tasks
+		enum {PARALLEL_CUTOFF=2000};
+		// Gaps between anchors which are no more complex than this are diffed exactly
+		enum {ANCHOR_WINDOW_COMPLEXITY=100000};
+		// Limit on the nesting of anchor searches, which bounds the time taken
+		enum {MAX_ANCHOR_DEPTH=8};
+		enum {NO_ID=0xffffffff};
 };
 
 //-----------------------------------------------------------------------------
@@ -146,21 +307,40 @@ class DiffEngine
 template<typename T>
 void DiffEngine<T>::clear()
 {
+	xids.clear();
+	yids.clear();
+	id_table.clear();
+	id_hashes.clear();
+	id_values.clear();
 	xchanged.clear();
 	ychanged.clear();
 	xv.clear();
 	yv.clear();
 	xind.clear();
 	yind.clear();
-	seq.clear();
-	in_seq.clear();
+	xhash.clear();
+	yhash.clear();
+	// diag_scratch is left alone, diag() resets what it uses
+	xmatch_start.clear();
+	xmatch_pos.clear();
+	ymatch_start.clear();
+	ymatch_pos.clear();
+	xcount.clear();
+	ycount.clear();
+	ypos.clear();
+	fdiag.clear();
+	bdiag.clear();
 	done = false;
 }
 
 template<typename T>
 void DiffEngine<T>::diff (const ValueVector & from_lines,
 		const ValueVector & to_lines, Diff<T> & diff,
-		long long bailoutComplexity /* = 0 */)
+		long long bailoutComplexity /* = 0 */,
+		DiffAlgorithm algorithm_ /* = DIFF_ALGORITHM_DAIRIKI */,
+		DiffBudget * budget_ /* = NULL */,
+		bool approximate /* = false */,
+		ThreadPool * pool_ /* = NULL */)
 {
 	int n_from = (int)from_lines.size();
 	int n_to = (int)to_lines.size();
@@ -169,21 +349,26 @@ void DiffEngine<T>::diff (const ValueVector & from_lines,
 	if (done) {
 		clear();
 	}
+	budget = budget_;
+	algorithm = algorithm_;
+	pool = pool_;
 	xchanged.resize(n_from);
 	ychanged.resize(n_to);
-	seq.resize(std::max(n_from, n_to) + 1);
+
+	// Map the lines to token IDs
+	intern(from_lines, to_lines);
 
 	// Skip leading common lines.
 	int skip, endskip;
 	for (skip = 0; skip < n_from && skip < n_to; skip++) {
-		if (from_lines[skip] != to_lines[skip])
+		if (xids[skip] != yids[skip])
 			break;
 		xchanged[skip] = ychanged[skip] = false;
 	}
 	// Skip trailing common lines.
 	int xi = n_from, yi = n_to;
 	for (endskip = 0; --xi > skip && --yi > skip; endskip++) {
-		if (from_lines[xi] != to_lines[yi])
+		if (xids[xi] != yids[yi])
 			break;
 		xchanged[xi] = ychanged[yi] = false;
 	}
@@ -191,51 +376,68 @@ void DiffEngine<T>::diff (const ValueVector & from_lines,
 	long long complexity = (long long)(n_from - skip - endskip)
 		* (n_to - skip - endskip);
 
-	// If too complex, just output "whole left side replaced with right"
-	if (bailoutComplexity > 0 && complexity > bailoutComplexity) {
-		PointerVector del;
-		PointerVector add;
-
-		for (xi = 0; xi < n_from; xi++) {
-			del.push_back(&from_lines[xi]);
-		}
-		for (yi = 0; yi < n_to; yi++) {
-			add.push_back(&to_lines[yi]);
-		}
-		diff.add_edit(DiffOp<T>(DiffOp<T>::change, del, add));
+	// If too complex, or if an earlier diff has used up the budget, just
+	// output "whole left side replaced with right"
+	if ((bailoutComplexity > 0 && complexity > bailoutComplexity) || out_of_budget()) {
+		diff.add_edit(DiffOp<T>(DiffOp<T>::change, Range(from_lines.data(), 0, n_from),
+			Range(to_lines.data(), 0, n_to)));
 
 		done = true;
 		return;
 	}
 
 	// Ignore lines which do not exist in both files.
-	ValueSet xhash, yhash;
+	xhash.assign(id_values.size(), false);
+	yhash.assign(id_values.size(), false);
 	for (xi = skip; xi < n_from - endskip; xi++) {
-		xhash.insert(from_lines[xi]);
+		xhash[xids[xi]] = true;
 	}
 
 	for (yi = skip; yi < n_to - endskip; yi++) {
-		const T & line = to_lines[yi];
-		if ( (ychanged[yi] = (xhash.find(line) == xhash.end())) )
+		uint32_t line = yids[yi];
+		if ( (ychanged[yi] = !xhash[line]) )
 			continue;
-		yhash.insert(line);
-		yv.push_back(&line);
+		yhash[line] = true;
+		yv.push_back(line);
 		yind.push_back(yi);
 	}
 	for (xi = skip; xi < n_from - endskip; xi++) {
-		const T & line = from_lines[xi];
-		if ( (xchanged[xi] = (yhash.find(line) == yhash.end())) )
+		uint32_t line = xids[xi];
+		if ( (xchanged[xi] = !yhash[line]) )
 			continue;
-		xv.push_back(&line);
+		xv.push_back(line);
 		xind.push_back(xi);
 	}
 
 	// Find the LCS.
-	compareseq(0, xv.size(), 0, yv.size());
+	if (algorithm == DIFF_ALGORITHM_MYERS) {
+		// Diagonals range from -yv.size() to xv.size(), plus a sentinel on each side
+		diag_offset = yv.size() + 1;
+		fdiag.resize(xv.size() + yv.size() + 3);
+		bdiag.resize(xv.size() + yv.size() + 3);
+	} else {
+		build_match_index(xv, xmatch_start, xmatch_pos);
+		build_match_index(yv, ymatch_start, ymatch_pos);
+
+		// Only go parallel if the problem is big enough to be split
+		if (pool && (int)(xv.size() + yv.size()) < PARALLEL_CUTOFF)
+			pool = NULL;
+		diag_scratch.resize(pool ? pool->size() + 1 : 1);
+	}
+	if (approximate) {
+		xcount.assign(id_values.size(), 0);
+		ycount.assign(id_values.size(), 0);
+		ypos.resize(id_values.size());
+		anchored_compareseq(0, xv.size(), 0, yv.size(), 0);
+	} else if (algorithm == DIFF_ALGORITHM_MYERS) {
+		myers_compareseq(0, xv.size(), 0, yv.size());
+	} else {
+		compareseq(0, xv.size(), 0, yv.size());
+	}
 
 	// Merge edits when possible
-	shift_boundaries(from_lines, xchanged, ychanged);
-	shift_boundaries(to_lines, ychanged, xchanged);
+	shift_boundaries(xids, xchanged, ychanged);
+	shift_boundaries(yids, ychanged, xchanged);
 
 	// Compute the edit operations.
 	xi = yi = 0;
@@ -244,39 +446,112 @@ void DiffEngine<T>::diff (const ValueVector & from_lines,
 		assert(xi < n_from || ychanged[yi]);
 
 		// Skip matching "snake".
-		PointerVector del;
-		PointerVector add;
-		PointerVector empty;
+		int xstart = xi, ystart = yi;
 		while (xi < n_from && yi < n_to && !xchanged[xi] && !ychanged[yi]) {
-			del.push_back(&from_lines[xi]);
-			add.push_back(&to_lines[yi]);
 			++xi;
 			++yi;
 		}
-		if (del.size()) {
-			diff.add_edit(DiffOp<T>(DiffOp<T>::copy, del, add));
-			del.clear();
-			add.clear();
+		if (xi > xstart) {
+			diff.add_edit(DiffOp<T>(DiffOp<T>::copy,
+				Range(from_lines.data(), xstart, xi - xstart),
+				Range(to_lines.data(), ystart, yi - ystart)));
 		}
 
 		// Find deletes & adds.
+		xstart = xi;
+		ystart = yi;
 		while (xi < n_from && xchanged[xi])
-			del.push_back(&from_lines[xi++]);
+			xi++;
 
 		while (yi < n_to && ychanged[yi])
-			add.push_back(&to_lines[yi++]);
+			yi++;
 
+		Range del(from_lines.data(), xstart, xi - xstart);
+		Range add(to_lines.data(), ystart, yi - ystart);
 		if (del.size() && add.size())
 			diff.add_edit(DiffOp<T>(DiffOp<T>::change, del, add));
 		else if (del.size())
-			diff.add_edit(DiffOp<T>(DiffOp<T>::del, del, empty));
+			diff.add_edit(DiffOp<T>(DiffOp<T>::del, del, Range()));
 		else if (add.size())
-			diff.add_edit(DiffOp<T>(DiffOp<T>::add, empty, add));
+			diff.add_edit(DiffOp<T>(DiffOp<T>::add, Range(), add));
 	}
 
 	done = true;
 }
 
+/* Assign a token ID to every line of both inputs. Lines compare equal if
+ * and only if they have the same ID. IDs are dense, starting from zero, so
+ * they can be used to index flat arrays.
+ */
+template<typename T>
+void DiffEngine<T>::intern (const ValueVector & from_lines, const ValueVector & to_lines)
+{
+	// Keep the load factor at or below one half
+	size_t size = 16;
+	while (size < 2 * (from_lines.size() + to_lines.size()))
+		size *= 2;
+	id_table.assign(size, NO_ID);
+
+	intern_lines(from_lines, xids);
+	intern_lines(to_lines, yids);
+}
+
+template<typename T>
+void DiffEngine<T>::intern_lines (const ValueVector & lines, IdVector & ids)
+{
+	DiffHash<T> hasher;
+	uint32_t mask = id_table.size() - 1;
+	int n = (int)lines.size();
+
+	ids.resize(n);
+	for (int i = 0; i < n; i++) {
+		const T & line = lines[i];
+		uint32_t hash = hasher(line);
+		uint32_t slot = hash & mask;
+		while (1) {
+			uint32_t id = id_table[slot];
+			if (id == NO_ID) {
+				// New token
+				id = id_values.size();
+				id_table[slot] = id;
+				id_hashes.push_back(hash);
+				id_values.push_back(&line);
+				ids[i] = id;
+				break;
+			}
+			if (id_hashes[id] == hash && *id_values[id] == line) {
+				ids[i] = id;
+				break;
+			}
+			slot = (slot + 1) & mask;
+		}
+	}
+}
+
+/* Build an index of the positions of each token ID in V, as a list of
+ * positions sorted by ID and then by position. This is done once per diff,
+ * after which diag() finds the matches in any subrange by binary search.
+ */
+template<typename T>
+void DiffEngine<T>::build_match_index (const IdVector & v, IntVector & start,
+		IntVector & pos)
+{
+	int n = (int)v.size();
+	start.assign(id_values.size() + 1, 0);
+	pos.resize(n);
+
+	// Count the occurrences of each ID, then turn the counts into offsets
+	for (int i = 0; i < n; i++)
+		start[v[i] + 1]++;
+	for (size_t id = 1; id < start.size(); id++)
+		start[id] += start[id - 1];
+
+	// Fill in the positions, using a copy of the offsets as cursors
+	match_fill.assign(start.begin(), start.end() - 1);
+	for (int i = 0; i < n; i++)
+		pos[match_fill[v[i]]++] = i;
+}
+
 /* Divide the Largest Common Subsequence (LCS) of the sequences
  * [XOFF, XLIM) and [YOFF, YLIM) into NCHUNKS approximately equally
  * sized segments.
@@ -295,13 +570,17 @@ void DiffEngine<T>::diff (const ValueVector & from_lines,
  */
 template <typename T>
 int DiffEngine<T>::diag (int xoff, int xlim, int yoff, int ylim, int nchunks,
-		IntPairVector & seps)
+		IntPair * seps, DiagScratch & scratch)
 {
 	using std::swap;
 	using std::make_pair;
 	using std::copy;
+	using std::lower_bound;
+	std::vector<int> & seq = scratch.seq;
+	std::vector<bool> & in_seq = scratch.in_seq;
+	std::vector<int> & ymids = scratch.ymids;
+	int & lcs = scratch.lcs;
 	bool flip = false;
-	MatchesMap ymatches;
 
 	if (xlim - xoff > ylim - yoff) {
 		// Things seems faster (I'm not sure I understand why)
@@ -311,47 +590,52 @@ int DiffEngine<T>::diag (int xoff, int xlim, int yoff, int ylim, int nchunks,
 		swap(xlim, ylim);
 	}
 
-	if (flip)
-		for (int i = ylim - 1; i >= yoff; i--)
-			ymatches[*xv[i]].push_back(i);
-	else
-		for (int i = ylim - 1; i >= yoff; i--)
-			ymatches[*yv[i]].push_back(i);
+	// The matches for each line of X are looked up in the match index of Y
+	const IntVector & match_start = flip ? xmatch_start : ymatch_start;
+	const IntVector & match_pos = flip ? xmatch_pos : ymatch_pos;
 
 	int nlines = ylim - yoff;
 	lcs = 0;
+	if ((int)seq.size() < nlines + 1)
+		seq.resize(nlines + 1);
+	if ((int)in_seq.size() < ylim)
+		in_seq.resize(ylim);
 	seq[0] = yoff - 1;
-	in_seq.clear();
 
 	// 2-d array, line major, chunk minor
-	IntVector ymids(nlines * nchunks);
+	ymids.assign(nlines * nchunks, 0);
 
 	int numer = xlim - xoff + nchunks - 1;
 	int x = xoff, x1, y1;
-	for (int chunk = 0; chunk < nchunks; chunk++) {
+	bool aborted = false;
+	for (int chunk = 0; chunk < nchunks && !aborted; chunk++) {
 		if (chunk > 0)
 			for (int i = 0; i <= lcs; i++)
 				ymids.at(i * nchunks + chunk-1) = seq[i];
 
 		x1 = xoff + (int)((numer + (xlim-xoff)*chunk) / nchunks);
 		for ( ; x < x1; x++) {
-			const T & line = flip ? *yv[x] : *xv[x];
-#ifdef USE_JUDY
-			IntVector * pMatches = ymatches.Get(line);
-			if (!pMatches)
-				continue;
-#else
-			typename MatchesMap::iterator iter = ymatches.find(line);
-			if (iter == ymatches.end())
+			if (out_of_budget()) {
+				aborted = true;
+				break;
+			}
+			uint32_t line = flip ? yv[x] : xv[x];
+			// Find the matches within [yoff, ylim), and visit them in
+			// descending order
+			IntVector::const_iterator first = match_pos.begin() + match_start[line];
+			IntVector::const_iterator last = match_pos.begin() + match_start[line + 1];
+			first = lower_bound(first, last, yoff);
+			last = lower_bound(first, last, ylim);
+			if (budget)
+				budget->spend(1 + (last - first));
+			if (first == last)
 				continue;
-			IntVector * pMatches = &(iter->second);
-#endif
-			IntVector::iterator y;
+			IntVector::const_reverse_iterator y(last), yend(first);
 			int k = 0;
 
-			for (y = pMatches->begin(); y != pMatches->end(); ++y) {
-				if (!in_seq.count(*y)) {
-					k = lcs_pos(*y);
+			for ( ; y != yend; ++y) {
+				if (!in_seq[*y]) {
+					k = lcs_pos(*y, scratch);
 					assert(k > 0);
 					copy(ymids.begin() + (k-1) * nchunks, ymids.begin() + k * nchunks,
 							ymids.begin() + k * nchunks);
@@ -359,16 +643,16 @@ int DiffEngine<T>::diag (int xoff, int xlim, int yoff, int ylim, int nchunks,
 					break;
 				}
 			}
-			for ( ; y != pMatches->end(); ++y) {
+			for ( ; y != yend; ++y) {
 				if (*y > seq[k-1]) {
 					assert(*y < seq[k]);
 					// Optimization: this is a common case:
 					//	next match is just replacing previous match.
-					in_seq.erase(seq[k]);
+					in_seq[seq[k]] = false;
 					seq[k] = *y;
-					in_seq.insert(*y);
-				} else if (!in_seq.count(*y)) {
-					k = lcs_pos(*y);
+					in_seq[*y] = true;
+				} else if (!in_seq[*y]) {
+					k = lcs_pos(*y, scratch);
 					assert(k > 0);
 					copy(ymids.begin() + (k-1) * nchunks, ymids.begin() + k * nchunks,
 							ymids.begin() + k * nchunks);
@@ -377,11 +661,17 @@ int DiffEngine<T>::diag (int xoff, int xlim, int yoff, int ylim, int nchunks,
 		}
 	}
 
-	seps.clear();
-	seps.resize(nchunks + 1);
+	// Reset in_seq for the next call
+	for (int i = 1; i <= lcs; i++)
+		in_seq[seq[i]] = false;
+
+	// Out of budget: report no common subsequence, so the caller marks the
+	// whole range as changed
+	if (aborted)
+		return lcs = 0;
 
 	seps[0] = flip ? make_pair(yoff, xoff) : make_pair(xoff, yoff);
-	IntVector::iterator ymid = ymids.begin() + lcs * nchunks;
+	std::vector<int>::iterator ymid = ymids.begin() + lcs * nchunks;
 	for (int n = 0; n < nchunks - 1; n++) {
 		x1 = xoff + (numer + (xlim - xoff) * n) / nchunks;
 		y1 = ymid[n] + 1;
@@ -392,11 +682,14 @@ int DiffEngine<T>::diag (int xoff, int xlim, int yoff, int ylim, int nchunks,
 }
 
 template <typename T>
-int DiffEngine<T>::lcs_pos (int ypos) {
+int DiffEngine<T>::lcs_pos (int ypos, DiagScratch & scratch) {
+	std::vector<int> & seq = scratch.seq;
+	std::vector<bool> & in_seq = scratch.in_seq;
+	int & lcs = scratch.lcs;
 	int end = lcs;
 	if (end == 0 || ypos > seq[end]) {
 		seq[++lcs] = ypos;
-		in_seq.insert(ypos);
+		in_seq[ypos] = true;
 		return lcs;
 	}
 
@@ -411,9 +704,9 @@ int DiffEngine<T>::lcs_pos (int ypos) {
 
 	assert(ypos != seq[end]);
 
-	in_seq.erase(seq[end]);
+	in_seq[seq[end]] = false;
 	seq[end] = ypos;
-	in_seq.insert(ypos);
+	in_seq[ypos] = true;
 	return end;
 }
 
@@ -430,31 +723,30 @@ int DiffEngine<T>::lcs_pos (int ypos) {
  */
 template <typename T>
 void DiffEngine<T>::compareseq (int xoff, int xlim, int yoff, int ylim) {
-	using std::pair;
-
-	IntPairVector seps;
-	int lcs;
+	IntPair seps[MAX_CHUNKS + 1];
+	int lcs, nchunks = 0;
 
 	// Slide down the bottom initial diagonal.
-	while (xoff < xlim && yoff < ylim && *xv[xoff] == *yv[yoff]) {
+	while (xoff < xlim && yoff < ylim && xv[xoff] == yv[yoff]) {
 		++xoff;
 		++yoff;
 	}
 
 	// Slide up the top initial diagonal.
-	while (xlim > xoff && ylim > yoff && *xv[xlim - 1] == *yv[ylim - 1]) {
+	while (xlim > xoff && ylim > yoff && xv[xlim - 1] == yv[ylim - 1]) {
 		--xlim;
 		--ylim;
 	}
 
-	if (xoff == xlim || yoff == ylim)
+	if (xoff == xlim || yoff == ylim || out_of_budget())
 		lcs = 0;
 	else {
 		// This is ad hoc but seems to work well.
 		//nchunks = sqrt(min(xlim - xoff, ylim - yoff) / 2.5);
 		//nchunks = max(2,min(8,(int)nchunks));
-		int nchunks = std::min(MAX_CHUNKS-1, std::min(xlim - xoff, ylim - yoff)) + 1;
-		lcs = diag(xoff, xlim, yoff, ylim, nchunks, seps);
+		nchunks = std::min(MAX_CHUNKS-1, std::min(xlim - xoff, ylim - yoff)) + 1;
+		lcs = diag(xoff, xlim, yoff, ylim, nchunks, seps,
+			diag_scratch[pool ? ThreadPool::currentWorker() : 0]);
 	}
 
 	if (lcs == 0) {
@@ -464,17 +756,270 @@ void DiffEngine<T>::compareseq (int xoff, int xlim, int yoff, int ylim) {
 			ychanged[yind[yoff++]] = true;
 		while (xoff < xlim)
 			xchanged[xind[xoff++]] = true;
-	} else {
+	} else if (!pool) {
 		// Use the partitions to split this problem into subproblems.
-		IntPairVector::iterator pt1, pt2;
-		pt1 = pt2 = seps.begin();
-		while (++pt2 != seps.end()) {
-			compareseq (pt1->first, pt2->first, pt1->second, pt2->second);
-			pt1 = pt2;
+		for (int i = 0; i < nchunks; i++)
+			compareseq (seps[i].first, seps[i+1].first, seps[i].second, seps[i+1].second);
+	} else {
+		// The subproblems cover disjoint ranges, so they can be solved
+		// concurrently. Hand the big ones to the pool and do the rest here.
+		ThreadPool::TaskGroup group;
+		for (int i = 0; i < nchunks; i++) {
+			int x0 = seps[i].first, x1 = seps[i+1].first;
+			int y0 = seps[i].second, y1 = seps[i+1].second;
+			if ((x1 - x0) + (y1 - y0) >= PARALLEL_CUTOFF)
+				pool->submit(group, [this, x0, x1, y0, y1] { compareseq(x0, x1, y0, y1); });
+			else
+				compareseq(x0, x1, y0, y1);
 		}
+		pool->wait(group);
 	}
 }
 
+/* Find the LCS of [XOFF, XLIM) and [YOFF, YLIM) with Myers' algorithm,
+ * recording the results in {x,y}changed[] in the same way as compareseq().
+ *
+ * The problem is split in two at the middle snake of a shortest edit
+ * script, so the recursion depth is O(log D) and only O(N+M) space is used.
+ */
+template <typename T>
+void DiffEngine<T>::myers_compareseq (int xoff, int xlim, int yoff, int ylim) {
+	// Slide down the bottom initial diagonal.
+	while (xoff < xlim && yoff < ylim && xv[xoff] == yv[yoff]) {
+		++xoff;
+		++yoff;
+	}
+
+	// Slide up the top initial diagonal.
+	while (xlim > xoff && ylim > yoff && xv[xlim - 1] == yv[ylim - 1]) {
+		--xlim;
+		--ylim;
+	}
+
+	int xmid, ymid;
+	if (xoff == xlim || yoff == ylim || !myers_split(xoff, xlim, yoff, ylim, xmid, ymid)) {
+		// One side is empty, or we ran out of budget: everything left is changed.
+		while (yoff < ylim)
+			ychanged[yind[yoff++]] = true;
+		while (xoff < xlim)
+			xchanged[xind[xoff++]] = true;
+	} else {
+		myers_compareseq(xoff, xmid, yoff, ymid);
+		myers_compareseq(xmid, xlim, ymid, ylim);
+	}
+}
+
+/* Find the midpoint of a shortest edit script for [XOFF, XLIM) and
+ * [YOFF, YLIM), by searching forwards from the start and backwards from
+ * the end at the same time until the two searches overlap on a diagonal.
+ *
+ * This is the diag() function of analyze.c (GNU diffutils-2.7), without
+ * the heuristics which trade minimality for speed.
+ *
+ * Returns false if the budget ran out before the midpoint was found.
+ */
+template <typename T>
+bool DiffEngine<T>::myers_split (int xoff, int xlim, int yoff, int ylim,
+		int & xmid, int & ymid)
+{
+	int * fd = &fdiag[diag_offset];
+	int * bd = &bdiag[diag_offset];
+	int dmin = xoff - ylim;	// Minimum valid diagonal.
+	int dmax = xlim - yoff;	// Maximum valid diagonal.
+	int fmid = xoff - yoff;	// Center diagonal of top-down search.
+	int bmid = xlim - ylim;	// Center diagonal of bottom-up search.
+	int fmin = fmid, fmax = fmid;	// Limits of top-down search.
+	int bmin = bmid, bmax = bmid;	// Limits of bottom-up search.
+	// True if southeast corner is on an odd diagonal with respect to the northwest.
+	bool odd = (fmid - bmid) & 1;
+
+	fd[fmid] = xoff;
+	bd[bmid] = xlim;
+
+	while (1) {
+		int d;
+
+		if (out_of_budget())
+			return false;
+		if (budget)
+			budget->spend(fmax - fmin + bmax - bmin + 2);
+
+		// Extend the top-down search by an edit step in each diagonal.
+		if (fmin > dmin)
+			fd[--fmin - 1] = -1;
+		else
+			++fmin;
+		if (fmax < dmax)
+			fd[++fmax + 1] = -1;
+		else
+			--fmax;
+		for (d = fmax; d >= fmin; d -= 2) {
+			int tlo = fd[d - 1], thi = fd[d + 1];
+			int x = tlo >= thi ? tlo + 1 : thi;
+			int y = x - d;
+			while (x < xlim && y < ylim && xv[x] == yv[y]) {
+				++x;
+				++y;
+			}
+			fd[d] = x;
+			if (odd && bmin <= d && d <= bmax && bd[d] <= x) {
+				xmid = x;
+				ymid = y;
+				return true;
+			}
+		}
+
+		// Similarly extend the bottom-up search.
+		if (bmin > dmin)
+			bd[--bmin - 1] = INT_MAX;
+		else
+			++bmin;
+		if (bmax < dmax)
+			bd[++bmax + 1] = INT_MAX;
+		else
+			--bmax;
+		for (d = bmax; d >= bmin; d -= 2) {
+			int tlo = bd[d - 1], thi = bd[d + 1];
+			int x = tlo < thi ? tlo : thi - 1;
+			int y = x - d;
+			while (x > xoff && y > yoff && xv[x - 1] == yv[y - 1]) {
+				--x;
+				--y;
+			}
+			bd[d] = x;
+			if (!odd && fmin <= d && d <= fmax && x <= fd[d]) {
+				xmid = x;
+				ymid = y;
+				return true;
+			}
+		}
+	}
+}
+
+/* Find an approximate LCS of [XOFF, XLIM) and [YOFF, YLIM) in O(n log n)
+ * time, recording the results in {x,y}changed[] like compareseq().
+ *
+ * Lines which occur exactly once in each range are anchors, and the longest
+ * run of anchors which appear in the same order on both sides is taken to be
+ * part of the LCS. The gaps between anchors are diffed exactly if they are
+ * small enough, otherwise they are searched for anchors again, down to
+ * MAX_ANCHOR_DEPTH levels. Anything left over is marked as changed.
+ */
+template <typename T>
+void DiffEngine<T>::anchored_compareseq (int xoff, int xlim, int yoff, int ylim,
+		int depth)
+{
+	// Slide down the bottom initial diagonal.
+	while (xoff < xlim && yoff < ylim && xv[xoff] == yv[yoff]) {
+		++xoff;
+		++yoff;
+	}
+
+	// Slide up the top initial diagonal.
+	while (xlim > xoff && ylim > yoff && xv[xlim - 1] == yv[ylim - 1]) {
+		--xlim;
+		--ylim;
+	}
+
+	if (xoff < xlim && yoff < ylim
+			&& (long long)(xlim - xoff) * (ylim - yoff) <= ANCHOR_WINDOW_COMPLEXITY)
+	{
+		if (algorithm == DIFF_ALGORITHM_MYERS)
+			myers_compareseq(xoff, xlim, yoff, ylim);
+		else
+			compareseq(xoff, xlim, yoff, ylim);
+		return;
+	}
+
+	IntPairVector anchors;
+	if (xoff < xlim && yoff < ylim && depth < MAX_ANCHOR_DEPTH)
+		find_anchors(xoff, xlim, yoff, ylim, anchors);
+
+	if (anchors.empty()) {
+		// Nothing more can be found cheaply: mark all changed.
+		while (yoff < ylim)
+			ychanged[yind[yoff++]] = true;
+		while (xoff < xlim)
+			xchanged[xind[xoff++]] = true;
+		return;
+	}
+
+	// The anchors themselves are unchanged; diff the gaps between them
+	IntPairVector::iterator anchor;
+	for (anchor = anchors.begin(); anchor != anchors.end(); ++anchor) {
+		anchored_compareseq(xoff, anchor->first, yoff, anchor->second, depth + 1);
+		xoff = anchor->first + 1;
+		yoff = anchor->second + 1;
+	}
+	anchored_compareseq(xoff, xlim, yoff, ylim, depth + 1);
+}
+
+/* Find the anchors for anchored_compareseq(): the longest sequence of
+ * (x, y) pairs, increasing in both x and y, where xv[x] == yv[y] and the
+ * line occurs only once in each of [XOFF, XLIM) and [YOFF, YLIM).
+ */
+template <typename T>
+void DiffEngine<T>::find_anchors (int xoff, int xlim, int yoff, int ylim,
+		IntPairVector & anchors)
+{
+	using std::make_pair;
+	int x, y;
+
+	// Count the occurrences of each line within the range
+	for (x = xoff; x < xlim; x++)
+		xcount[xv[x]]++;
+	for (y = yoff; y < ylim; y++) {
+		ycount[yv[y]]++;
+		ypos[yv[y]] = y;
+	}
+
+	// Collect the unique matches, in order of x
+	IntPairVector candidates;
+	for (x = xoff; x < xlim; x++) {
+		uint32_t line = xv[x];
+		if (xcount[line] == 1 && ycount[line] == 1)
+			candidates.push_back(make_pair(x, ypos[line]));
+	}
+
+	// Reset the counts for the next call
+	for (x = xoff; x < xlim; x++)
+		xcount[xv[x]] = 0;
+	for (y = yoff; y < ylim; y++)
+		ycount[yv[y]] = 0;
+
+	// Find the longest subsequence of candidates increasing in y, by patience
+	// sorting. tails[k] is the candidate with the smallest y ending a
+	// subsequence of length k+1, and prev links each candidate to its
+	// predecessor in the subsequence.
+	int n = (int)candidates.size();
+	IntVector tails, prev(n);
+	for (int i = 0; i < n; i++) {
+		y = candidates[i].second;
+		int beg = 0, end = tails.size();
+		while (beg < end) {
+			int mid = (beg + end) / 2;
+			if (candidates[tails[mid]].second < y)
+				beg = mid + 1;
+			else
+				end = mid;
+		}
+		prev[i] = beg > 0 ? tails[beg - 1] : -1;
+		if (beg == (int)tails.size())
+			tails.push_back(i);
+		else
+			tails[beg] = i;
+	}
+
+	anchors.resize(tails.size());
+	for (int i = tails.empty() ? -1 : tails.back(), k = tails.size(); i >= 0; i = prev[i])
+		anchors[--k] = candidates[i];
+}
+
+template <typename T>
+inline bool DiffEngine<T>::out_of_budget() const {
+	return budget && budget->exhausted();
+}
+
 /* Adjust inserts/deletes of identical lines to join changes
  * as much as possible.
  *
@@ -488,8 +1033,8 @@ void DiffEngine<T>::compareseq (int xoff, int xlim, int yoff, int ylim) {
  * This is extracted verbatim from analyze.c (GNU diffutils-2.7).
  */
 template <typename T>
-void DiffEngine<T>::shift_boundaries (const ValueVector & lines, BoolVector & changed,
-		const BoolVector & other_changed)
+void DiffEngine<T>::shift_boundaries (const IdVector & lines, FlagVector & changed,
+		const FlagVector & other_changed)
 {
 	int i = 0;
 	int j = 0;
@@ -595,10 +1140,17 @@ void DiffEngine<T>::shift_boundaries (const ValueVector & lines, BoolVector & ch
 
 template<typename T>
 Diff<T>::Diff(const ValueVector & from_lines, const ValueVector & to_lines,
-	long long bailoutComplexity)
+	long long bailoutComplexity, DiffAlgorithm algorithm, DiffBudget * budget,
+	bool approximate, ThreadPool * pool, DiffEngine<T> * engine)
 {
-	DiffEngine<T> engine;
-	engine.diff(from_lines, to_lines, *this, bailoutComplexity);
+	if (engine) {
+		engine->diff(from_lines, to_lines, *this, bailoutComplexity, algorithm, budget,
+			approximate, pool);
+	} else {
+		DiffEngine<T> localEngine;
+		localEngine.diff(from_lines, to_lines, *this, bailoutComplexity, algorithm, budget,
+			approximate, pool);
+	}
 }
 
 #endif
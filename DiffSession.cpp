@@ -0,0 +1,265 @@
+#include <string.h>
+#include <algorithm>
+#include "DiffSession.h"
+
+std::atomic<size_t> DiffSession::capacity(0);
+
+DiffSession::DiffSession(const char * base_, size_t length)
+	: base(base_, base_ + length), hasDraft(false)
+{
+	splitLines(base.data(), base.data() + base.size(), baseLines);
+}
+
+std::shared_ptr<DiffSession> DiffSession::open(const std::string & key, const char * base_,
+		size_t length)
+{
+	// Most recently opened first
+	static thread_local SessionList sessions;
+
+	for (SessionList::iterator it = sessions.begin(); it != sessions.end(); ++it) {
+		if (it->first != key) {
+			continue;
+		}
+		if (it->second->hasBase(base_, length)) {
+			sessions.splice(sessions.begin(), sessions, it);
+			return it->second;
+		}
+		// The page was edited by someone else, so start again
+		sessions.erase(it);
+		break;
+	}
+
+	std::shared_ptr<DiffSession> session = std::make_shared<DiffSession>(base_, length);
+	size_t limit = capacity;
+	size_t used = session->memoryUsage();
+	if (used > limit) {
+		return session;
+	}
+	sessions.push_front(std::make_pair(key, session));
+	SessionList::iterator it = ++sessions.begin();
+	while (it != sessions.end() && used + it->second->memoryUsage() <= limit) {
+		used += it->second->memoryUsage();
+		++it;
+	}
+	sessions.erase(it, sessions.end());
+	return session;
+}
+
+bool DiffSession::hasBase(const char * base_, size_t length) const
+{
+	return length == base.size() && (!length || !memcmp(base.data(), base_, length));
+}
+
+size_t DiffSession::memoryUsage() const
+{
+	return base.capacity() + draft.capacity()
+		+ (baseLines.capacity() + draftLines.capacity()) * sizeof(Line)
+		+ edits.capacity() * sizeof(Edit) + sizeof(*this);
+}
+
+// Split a text into lines as Wikidiff2::explodeLines() does
+void DiffSession::splitLines(const char * begin, const char * end, LineTable & lines)
+{
+	const char * ptr = begin;
+	while (ptr != end) {
+		const char * ptr2 = (const char*)memchr(ptr, '\n', end - ptr);
+		if (!ptr2) {
+			ptr2 = end;
+		}
+		lines.push_back(Line(ptr, ptr2 - ptr));
+
+		ptr = ptr2;
+		if (ptr != end) {
+			++ptr;
+		}
+	}
+}
+
+void DiffSession::update(const char * text, size_t length, DiffEngine<Line> & engine,
+		DiffAlgorithm algorithm, DiffBudget * budget)
+{
+	if (!hasDraft) {
+		draft.assign(text, text + length);
+		splitLines(draft.data(), draft.data() + draft.size(), draftLines);
+		hasDraft = true;
+		rediff(Cut(0, 0), Cut(baseLines.size(), 0), draftLines.size(), engine, algorithm,
+			budget);
+		return;
+	}
+
+	// Replace the lines which changed since the last draft. The edit script
+	// still refers to the old draft, whose line count is kept.
+	int oldSize = draftLines.size();
+	int changeStart, oldChangeEnd, newChangeEnd;
+	replaceDraft(text, length, changeStart, oldChangeEnd, newChangeEnd);
+	if (changeStart == oldChangeEnd && changeStart == newChangeEnd) {
+		return;
+	}
+
+	// Diff the changed lines again, with a margin on each side, and the base
+	// lines which the script aligns with them
+	Cut start = findCutBefore(std::max(0, changeStart - MARGIN_LINES));
+	Cut end = findCutAfter(std::min(oldSize, oldChangeEnd + MARGIN_LINES));
+	rediff(start, end, end.to + newChangeEnd - oldChangeEnd, engine, algorithm, budget);
+}
+
+/**
+ * Make the given text the draft, keeping the lines which it has in common
+ * with the old one. On return, the changed lines are [changeStart,
+ * oldChangeEnd) of the old draft and [changeStart, newChangeEnd) of the new.
+ */
+void DiffSession::replaceDraft(const char * text, size_t length, int & changeStart,
+		int & oldChangeEnd, int & newChangeEnd)
+{
+	size_t start, end1, end2;
+	Wikidiff2::trimCommonLines(draft.data(), draft.size(), text, length, 0, start, end1, end2);
+
+	const char * oldData = draft.data();
+	auto startsBefore = [](const Line & line, const char * p) { return line.start < p; };
+	LineTable::iterator first = std::lower_bound(draftLines.begin(), draftLines.end(),
+		oldData + start, startsBefore);
+	LineTable::iterator last = std::lower_bound(first, draftLines.end(),
+		oldData + end1, startsBefore);
+	changeStart = first - draftLines.begin();
+	oldChangeEnd = last - draftLines.begin();
+
+	// Copy the common lines, pointing them at the new text. Those after the
+	// change move by the difference in length.
+	std::vector<char> newDraft(text, text + length);
+	const char * newData = newDraft.data();
+	ptrdiff_t shift = (ptrdiff_t)end2 - (ptrdiff_t)end1;
+	LineTable lines;
+	lines.reserve(draftLines.size() + (oldChangeEnd - changeStart) + 16);
+	for (LineTable::iterator it = draftLines.begin(); it != first; ++it) {
+		lines.push_back(*it);
+		lines.back().start = newData + (it->start - oldData);
+	}
+	splitLines(newData + start, newData + end2, lines);
+	newChangeEnd = lines.size();
+	for (LineTable::iterator it = last; it != draftLines.end(); ++it) {
+		lines.push_back(*it);
+		lines.back().start = newData + (it->start - oldData) + shift;
+	}
+	draft.swap(newDraft);
+	draftLines.swap(lines);
+}
+
+/**
+ * The latest cut in the script at or before the given line of the draft.
+ * If it would fall just after a change, it is moved to the start of the
+ * change, so that the base lines deleted there are diffed again too.
+ */
+DiffSession::Cut DiffSession::findCutBefore(int line) const
+{
+	for (size_t i = 0; i < edits.size(); i++) {
+		const Edit & edit = edits[i];
+		if (line >= edit.toStart + edit.toLength) {
+			continue;
+		}
+		if (edit.op == DiffOp<Line>::copy && (line > edit.toStart || i == 0)) {
+			return Cut(edit.fromStart + line - edit.toStart, line);
+		}
+		if (edit.op == DiffOp<Line>::copy) {
+			i--;
+		}
+		return Cut(edits[i].fromStart, edits[i].toStart);
+	}
+	if (edits.size() && edits.back().op != DiffOp<Line>::copy) {
+		return Cut(edits.back().fromStart, edits.back().toStart);
+	}
+	return Cut(baseLines.size(), line);
+}
+
+/** The earliest cut in the script at or after the given line of the draft */
+DiffSession::Cut DiffSession::findCutAfter(int line) const
+{
+	for (size_t i = 0; i < edits.size(); i++) {
+		const Edit & edit = edits[i];
+		if (line >= edit.toStart + edit.toLength) {
+			continue;
+		}
+		if (edit.op == DiffOp<Line>::copy) {
+			return Cut(edit.fromStart + line - edit.toStart, line);
+		}
+		return Cut(edit.fromStart + edit.fromLength, edit.toStart + edit.toLength);
+	}
+	return Cut(baseLines.size(), line);
+}
+
+/**
+ * Replace the part of the script between two cuts with a diff of the base
+ * lines between them and the draft lines from start.to to newEnd
+ */
+void DiffSession::rediff(Cut start, Cut end, int newEnd, DiffEngine<Line> & engine,
+		DiffAlgorithm algorithm, DiffBudget * budget)
+{
+	int shift = newEnd - end.to;
+	EditVector result;
+	result.reserve(edits.size() + 8);
+
+	// The edits before the start, with a copy across it cut short
+	for (size_t i = 0; i < edits.size(); i++) {
+		const Edit & edit = edits[i];
+		if (edit.fromStart + edit.fromLength <= start.from
+			&& edit.toStart + edit.toLength <= start.to)
+		{
+			addEdit(result, edit);
+		} else if (edit.fromStart < start.from || edit.toStart < start.to) {
+			addEdit(result, Edit(edit.op, edit.fromStart, start.from - edit.fromStart,
+				edit.toStart, start.to - edit.toStart));
+		}
+	}
+
+	// The window
+	Wikidiff2::LineVector lines1(baseLines.begin() + start.from, baseLines.begin() + end.from);
+	Wikidiff2::LineVector lines2(draftLines.begin() + start.to, draftLines.begin() + newEnd);
+	Wikidiff2::LineDiff linediff(lines1, lines2, 0, algorithm, budget, false, NULL, &engine);
+	int from = start.from, to = start.to;
+	for (size_t i = 0; i < linediff.size(); i++) {
+		const DiffOp<Line> & op = linediff[i];
+		addEdit(result, Edit(op.op, from, op.from.size(), to, op.to.size()));
+		from += op.from.size();
+		to += op.to.size();
+	}
+
+	// The edits after the end, with a copy across it cut short, moved by
+	// the change in the number of lines
+	for (size_t i = 0; i < edits.size(); i++) {
+		const Edit & edit = edits[i];
+		int fromEnd = edit.fromStart + edit.fromLength;
+		int toEnd = edit.toStart + edit.toLength;
+		if (edit.fromStart >= end.from && edit.toStart >= end.to) {
+			addEdit(result, Edit(edit.op, edit.fromStart, edit.fromLength,
+				edit.toStart + shift, edit.toLength));
+		} else if (fromEnd > end.from || toEnd > end.to) {
+			addEdit(result, Edit(edit.op, end.from, fromEnd - end.from, end.to + shift,
+				toEnd - end.to));
+		}
+	}
+	edits.swap(result);
+}
+
+/**
+ * Append an edit to a script, merging it with the last one so that copies
+ * and changes alternate, as they do in the output of the diff engine
+ */
+void DiffSession::addEdit(EditVector & edits, const Edit & edit)
+{
+	if (!edit.fromLength && !edit.toLength) {
+		return;
+	}
+	if (edits.size()) {
+		Edit & last = edits.back();
+		bool lastIsCopy = last.op == DiffOp<Line>::copy;
+		if (lastIsCopy == (edit.op == DiffOp<Line>::copy)) {
+			last.fromLength += edit.fromLength;
+			last.toLength += edit.toLength;
+			if (!lastIsCopy) {
+				last.op = !last.fromLength ? DiffOp<Line>::add
+					: !last.toLength ? DiffOp<Line>::del : DiffOp<Line>::change;
+			}
+			return;
+		}
+	}
+	edits.push_back(edit);
+}
@@ -0,0 +1,129 @@
+#ifndef DIFFSESSION_H
+#define DIFFSESSION_H
+
+#include <stddef.h>
+#include <list>
+#include <memory>
+#include <string>
+#include <vector>
+#include <atomic>
+#include "Wikidiff2.h"
+
+/**
+ * The state of a diff of one base text against a succession of drafts, as
+ * in a live preview of an edit, which diffs the same revision against a
+ * slightly different draft on every keystroke.
+ *
+ * The session keeps the lines of the base text and of the last draft, with
+ * their hashes, and the edit script between them. A new draft is compared
+ * with the last one byte by byte, and only the lines which changed, plus a
+ * few on each side, are split, hashed and diffed again. The rest of the edit
+ * script is kept. The cost of an update is then mostly that of the change
+ * since the last draft, not that of the page. Only the byte comparison and
+ * the copying of the draft and of the line table take time in proportion to
+ * the size of the page, and these are cheap.
+ *
+ * Where a change could be aligned in more than one way, the result may differ
+ * from a diff of the whole texts, but it is always a valid diff.
+ *
+ * Sessions outlive requests, so they allocate with malloc() rather than from
+ * the PHP request pool.
+ */
+class DiffSession {
+	public:
+		typedef std::vector<Line> LineTable;
+
+		/**
+		 * An operation of the edit script, with positions as line indexes,
+		 * and one of the DiffOp operations
+		 */
+		struct Edit {
+			Edit(int op_, int fromStart_, int fromLength_, int toStart_, int toLength_)
+				: op(op_), fromStart(fromStart_), fromLength(fromLength_), toStart(toStart_),
+				toLength(toLength_) {}
+			int op;
+			int fromStart, fromLength;
+			int toStart, toLength;
+		};
+		typedef std::vector<Edit> EditVector;
+
+		// The base text is copied
+		DiffSession(const char * base_, size_t length);
+
+		/**
+		 * Get the calling thread's session with the given key, if it has the
+		 * given base text, or else a new one, which is kept for later calls
+		 * if there is room for it
+		 */
+		static std::shared_ptr<DiffSession> open(const std::string & key, const char * base_,
+				size_t length);
+
+		/**
+		 * Set the memory which the sessions kept by each thread may use, in
+		 * bytes, so that N threads may use up to N times as much. Zero means
+		 * that none are kept. It is zero until this is called, which the
+		 * extension does at startup with wikidiff2.session_cache_size, by
+		 * default 4MB. The least recently opened are dropped when a session
+		 * is opened.
+		 */
+		static void setCapacity(size_t capacity_) { capacity = capacity_; }
+
+		bool hasBase(const char * base_, size_t length) const;
+
+		/**
+		 * Make the given text the current draft, which is copied, and bring
+		 * the edit script up to date, diffing with the given engine
+		 */
+		void update(const char * text, size_t length, DiffEngine<Line> & engine,
+				DiffAlgorithm algorithm, DiffBudget * budget);
+
+		// The copies of the texts, which the lines point into
+		const char * getBaseText() const { return base.data(); }
+		const char * getDraftText() const { return draft.data(); }
+		const LineTable & getBaseLines() const { return baseLines; }
+		const LineTable & getDraftLines() const { return draftLines; }
+		const EditVector & getEdits() const { return edits; }
+
+		/** An estimate of the memory used by the session, in bytes */
+		size_t memoryUsage() const;
+
+	protected:
+		enum {
+			// Unchanged lines diffed again on each side of a change, to give
+			// boundary shifts some room
+			MARGIN_LINES = 2
+		};
+
+		/**
+		 * A point between two operations of the edit script, or inside a
+		 * copy, at which the script can be split
+		 */
+		struct Cut {
+			Cut(int from_, int to_) : from(from_), to(to_) {}
+			int from, to;
+		};
+
+		typedef std::list<std::pair<std::string, std::shared_ptr<DiffSession> > > SessionList;
+
+		Cut findCutBefore(int line) const;
+		Cut findCutAfter(int line) const;
+		void replaceDraft(const char * text, size_t length, int & changeStart, int & oldChangeEnd,
+				int & newChangeEnd);
+		void rediff(Cut start, Cut end, int newEnd, DiffEngine<Line> & engine,
+				DiffAlgorithm algorithm, DiffBudget * budget);
+		static void addEdit(EditVector & edits, const Edit & edit);
+		static void splitLines(const char * begin, const char * end, LineTable & lines);
+
+		// Vectors rather than strings, so that swapping them never moves
+		// the characters which the lines point to
+		std::vector<char> base;
+		std::vector<char> draft;
+		LineTable baseLines;
+		LineTable draftLines;
+		EditVector edits;
+		bool hasDraft;
+
+		static std::atomic<size_t> capacity;
+};
+
+#endif
@@ -0,0 +1,182 @@
+#include <string.h>
+#include "Wikidiff2.h"
+#include "EditScriptDiff.h"
+#include "WordDiffCache.h"
+
+void EditScriptDiff::printStart()
+{
+	result += "WD2";
+	result += (char)FORMAT_VERSION;
+}
+
+void EditScriptDiff::printAdd(const Line & line)
+{
+	result += (char)RECORD_ADD;
+	printNumber(line.start - textBegin2, result);
+	printNumber(line.length, result);
+}
+
+void EditScriptDiff::printDelete(const Line & line)
+{
+	result += (char)RECORD_DELETE;
+	printNumber(line.start - textBegin1, result);
+	printNumber(line.length, result);
+}
+
+void EditScriptDiff::printWordDiff(const Line & text1, const Line & text2, String & out,
+		DiffEngine<Word> & engine)
+{
+	printLines(RECORD_CHANGE, text1, text2, out);
+	printWordOps(text1, text2, out, engine);
+}
+
+void EditScriptDiff::printMove(const Line & from, const Line & to, bool added, int leftLine,
+		int rightLine)
+{
+	printLines(added ? RECORD_MOVE_ADD : RECORD_MOVE_DELETE, from, to, result);
+	printWordOps(from, to, result, wordEngine);
+}
+
+void EditScriptDiff::printBlockHeader(int leftLine, int rightLine)
+{
+	result += (char)RECORD_BLOCK;
+	printNumber(leftLine, result);
+	printNumber(rightLine, result);
+}
+
+void EditScriptDiff::printContext(const Line & from, const Line & to)
+{
+	result += (char)RECORD_CONTEXT;
+	printNumber(from.start - textBegin1, result);
+	printNumber(to.start - textBegin2, result);
+	printNumber(from.length, result);
+}
+
+// Print a record with a line of each text
+void EditScriptDiff::printLines(int type, const Line & from, const Line & to, String & out)
+{
+	out += (char)type;
+	printNumber(from.start - textBegin1, out);
+	printNumber(from.length, out);
+	printNumber(to.start - textBegin2, out);
+	printNumber(to.length, out);
+}
+
+// Print the word ops of two lines. They don't depend on where the lines are,
+// so they can be cached.
+void EditScriptDiff::printWordOps(const Line & text1, const Line & text2, String & out,
+		DiffEngine<Word> & engine)
+{
+	// The cache is skipped under a work limit, since a cached diff could be
+	// more detailed than the limit would allow
+	WordDiffCache & cache = WordDiffCache::current();
+	bool useCache = WordDiffCache::enabled() && !budget.limit;
+	if (useCache) {
+		const std::string * cached = cache.lookup(WordDiffCache::FORMAT_EDIT_SCRIPT, algorithm,
+			text1, text2);
+		if (cached) {
+			out.append(cached->data(), cached->size());
+			return;
+		}
+	}
+	size_t start = out.size();
+
+	WordVector words1, words2;
+	explodeWords(text1, words1);
+	explodeWords(text2, words2);
+	WordDiff worddiff(words1, words2, MAX_WORD_LEVEL_DIFF_COMPLEXITY, algorithm, &budget,
+		false, NULL, &engine);
+
+	printNumber(worddiff.size(), out);
+	for (size_t i = 0; i < worddiff.size(); i++) {
+		DiffOp<Word> & op = worddiff[i];
+		out += (char)op.op;
+		if (op.op != DiffOp<Word>::add) {
+			printNumber(op.from[op.from.size() - 1]->suffixEnd - op.from[0]->bodyStart, out);
+		}
+		if (op.op != DiffOp<Word>::del) {
+			printNumber(op.to[op.to.size() - 1]->suffixEnd - op.to[0]->bodyStart, out);
+		}
+	}
+
+	if (useCache) {
+		cache.store(WordDiffCache::FORMAT_EDIT_SCRIPT, algorithm, text1, text2,
+			out.data() + start, out.size() - start);
+	}
+}
+
+bool EditScriptDiff::readNumber(const char * & p, const char * end, size_t & value)
+{
+	value = 0;
+	for (int shift = 0; p != end && shift < 64; shift += 7) {
+		unsigned char byte = (unsigned char)*p++;
+		value |= (size_t)(byte & 0x7f) << shift;
+		if (!(byte & 0x80)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool EditScriptDiff::decode(const char * data, size_t length, RecordVector & records,
+		WordRecordVector & words)
+{
+	const char * p = data;
+	const char * end = data + length;
+	if (length < 4 || memcmp(p, "WD2", 3) || p[3] != FORMAT_VERSION) {
+		return false;
+	}
+	p += 4;
+
+	while (p != end) {
+		Record record = Record();
+		record.type = (unsigned char)*p++;
+		record.firstWord = words.size();
+		bool ok;
+		switch (record.type) {
+			case RECORD_BLOCK:
+				ok = readNumber(p, end, record.from) && readNumber(p, end, record.to);
+				break;
+			case RECORD_CONTEXT:
+				ok = readNumber(p, end, record.from) && readNumber(p, end, record.to)
+					&& readNumber(p, end, record.fromLength);
+				record.toLength = record.fromLength;
+				break;
+			case RECORD_DELETE:
+				ok = readNumber(p, end, record.from) && readNumber(p, end, record.fromLength);
+				break;
+			case RECORD_ADD:
+				ok = readNumber(p, end, record.to) && readNumber(p, end, record.toLength);
+				break;
+			case RECORD_CHANGE:
+			case RECORD_MOVE_DELETE:
+			case RECORD_MOVE_ADD:
+				ok = readNumber(p, end, record.from) && readNumber(p, end, record.fromLength)
+					&& readNumber(p, end, record.to) && readNumber(p, end, record.toLength)
+					&& readNumber(p, end, record.numWords)
+					&& record.numWords <= (size_t)(end - p);
+				for (size_t i = 0, from = record.from, to = record.to;
+					ok && i < record.numWords; i++)
+				{
+					WordRecord word = WordRecord();
+					word.op = p != end ? (unsigned char)*p++ : -1;
+					word.from = from;
+					word.to = to;
+					ok = word.op >= DiffOp<Word>::copy && word.op <= DiffOp<Word>::change
+						&& (word.op == DiffOp<Word>::add || readNumber(p, end, word.fromLength))
+						&& (word.op == DiffOp<Word>::del || readNumber(p, end, word.toLength));
+					from += word.fromLength;
+					to += word.toLength;
+					words.push_back(word);
+				}
+				break;
+			default:
+				ok = false;
+		}
+		if (!ok) {
+			return false;
+		}
+		records.push_back(record);
+	}
+	return true;
+}
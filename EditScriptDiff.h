@@ -0,0 +1,108 @@
+#ifndef EDITSCRIPTDIFF_H
+#define EDITSCRIPTDIFF_H
+
+#include "Wikidiff2.h"
+
+/**
+ * Renders a diff as a compact binary edit script rather than as HTML. The
+ * changed lines, their context and their word-level changes are given as
+ * byte ranges into the two texts, so that the client, which has the texts,
+ * can render them however it likes. The script is much smaller than the
+ * HTML, and so is cheaper to cache and to send.
+ *
+ * The script starts with the magic "WD2" and a version byte. Then each
+ * record is a type byte followed by unsigned LEB128 numbers:
+ *
+ *   RECORD_BLOCK        leftLine rightLine
+ *   RECORD_CONTEXT      from to length
+ *   RECORD_DELETE       from length
+ *   RECORD_ADD          to length
+ *   RECORD_CHANGE       from fromLength to toLength words
+ *   RECORD_MOVE_DELETE  from fromLength to toLength words
+ *   RECORD_MOVE_ADD     from fromLength to toLength words
+ *
+ * Offsets are in bytes from the start of the old ("from") and new ("to")
+ * text, and lengths leave out the newline. A move is given at both ends,
+ * with the deleted line as from and the added copy as to.
+ *
+ * The words of a change or a move are their number, followed by a DiffOp
+ * operation byte for each word op, followed by the length of its old words,
+ * unless it is an add, and of its new words, unless it is a delete. The word
+ * ops follow each other from the start of the two lines.
+ */
+class EditScriptDiff: public Wikidiff2 {
+	public:
+		enum {
+			FORMAT_VERSION = 1
+		};
+
+		enum RecordType {
+			RECORD_BLOCK = 1,
+			RECORD_CONTEXT,
+			RECORD_DELETE,
+			RECORD_ADD,
+			RECORD_CHANGE,
+			RECORD_MOVE_DELETE,
+			RECORD_MOVE_ADD
+		};
+
+		/**
+		 * A decoded record. For RECORD_BLOCK, from and to are the line
+		 * numbers. The lengths of a side which the record does not have are
+		 * zero.
+		 */
+		struct Record {
+			int type;
+			size_t from, fromLength;
+			size_t to, toLength;
+			// The word ops of a change or move, as a range of the decoded words
+			size_t firstWord, numWords;
+		};
+
+		/** A decoded word op, with the offsets resolved */
+		struct WordRecord {
+			int op;
+			size_t from, fromLength;
+			size_t to, toLength;
+		};
+
+		typedef std::vector<Record, WD2_ALLOCATOR<Record> > RecordVector;
+		typedef std::vector<WordRecord, WD2_ALLOCATOR<WordRecord> > WordRecordVector;
+
+		/**
+		 * Decode an edit script. Returns false if it is not one, is of
+		 * another version or is truncated.
+		 */
+		static bool decode(const char * data, size_t length, RecordVector & records,
+				WordRecordVector & words);
+
+	protected:
+		void printStart();
+		void printAdd(const Line & line);
+		void printDelete(const Line & line);
+		void printWordDiff(const Line & text1, const Line & text2, String & out,
+				DiffEngine<Word> & engine);
+		void printBlockHeader(int leftLine, int rightLine);
+		void printContext(const Line & from, const Line & to);
+		void printMove(const Line & from, const Line & to, bool added, int leftLine,
+				int rightLine);
+
+		void printLines(int type, const Line & from, const Line & to, String & out);
+		void printWordOps(const Line & text1, const Line & text2, String & out,
+				DiffEngine<Word> & engine);
+		static inline void printNumber(size_t value, String & out);
+		static bool readNumber(const char * & p, const char * end, size_t & value);
+};
+
+// Append a number as an unsigned LEB128: seven bits per byte, least
+// significant first, with the top bit set on all but the last byte
+inline void EditScriptDiff::printNumber(size_t value, String & out)
+{
+	while (value >= 0x80) {
+		out += (char)(value | 0x80);
+		value >>= 7;
+	}
+	out += (char)value;
+}
+
+#endif
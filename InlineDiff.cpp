@@ -1,25 +1,83 @@
 #include "InlineDiff.h"
+#include "WordDiffCache.h"
 
-void InlineDiff::printAdd(const String& line)
+void InlineDiff::printAdd(const Line & line)
 {
 	printWrappedLine("<div class=\"mw-diff-inline-added\"><ins>", line, "</ins></div>\n");
 }
 
-void InlineDiff::printDelete(const String& line)
+void InlineDiff::printDelete(const Line & line)
 {
 	printWrappedLine("<div class=\"mw-diff-inline-deleted\"><del>", line, "</del></div>\n");
 }
 
-void InlineDiff::printWordDiff(const String& text1, const String& text2)
+void InlineDiff::printWordDiff(const Line & text1, const Line & text2, String & out,
+		DiffEngine<Word> & engine)
 {
+	// The cache is skipped under a work limit, since a cached diff could be
+	// more detailed than the limit would allow
+	WordDiffCache & cache = WordDiffCache::current();
+	bool useCache = WordDiffCache::enabled() && !budget.limit;
+	if (useCache) {
+		const std::string * cached = cache.lookup(WordDiffCache::FORMAT_INLINE, algorithm,
+			text1, text2);
+		if (cached) {
+			out.append(cached->data(), cached->size());
+			return;
+		}
+	}
+	size_t start = out.size();
+
 	WordVector words1, words2;
 
 	explodeWords(text1, words1);
 	explodeWords(text2, words2);
-	WordDiff worddiff(words1, words2, MAX_WORD_LEVEL_DIFF_COMPLEXITY);
-	String word;
+	WordDiff worddiff(words1, words2, MAX_WORD_LEVEL_DIFF_COMPLEXITY, algorithm, &budget,
+		false, NULL, &engine);
+
+	out += "<div class=\"mw-diff-inline-changed\">";
+	printWordDiffOps(worddiff, out);
+	out += "</div>\n";
+
+	if (useCache) {
+		cache.store(WordDiffCache::FORMAT_INLINE, algorithm, text1, text2,
+			out.data() + start, out.size() - start);
+	}
+}
+
+void InlineDiff::printMove(const Line & from, const Line & to, bool added, int leftLine,
+		int rightLine)
+{
+	char buf[256]; // should be plenty
+	if (!added) {
+		snprintf(buf, sizeof(buf),
+			"<div class=\"mw-diff-inline-moved mw-diff-inline-moved-source\">"
+			"<a name=\"movedpara_%u_%u_lhs\"></a>"
+			"<a class=\"mw-diff-movedpara-left\" href=\"#movedpara_%u_%u_rhs\">&#x26AB;</a> <del>",
+			leftLine, rightLine, leftLine, rightLine);
+		printWrappedLine(buf, from, "</del></div>\n");
+		return;
+	}
+
+	WordVector words1, words2;
+	explodeWords(from, words1);
+	explodeWords(to, words2);
+	WordDiff worddiff(words1, words2, MAX_WORD_LEVEL_DIFF_COMPLEXITY, algorithm, &budget,
+		false, NULL, &wordEngine);
 
-	result += "<div class=\"mw-diff-inline-changed\">";
+	snprintf(buf, sizeof(buf),
+		"<div class=\"mw-diff-inline-moved mw-diff-inline-moved-destination\">"
+		"<a name=\"movedpara_%u_%u_rhs\"></a>"
+		"<a class=\"mw-diff-movedpara-right\" href=\"#movedpara_%u_%u_lhs\">&#x26AB;</a> ",
+		leftLine, rightLine, leftLine, rightLine);
+	result += buf;
+	printWordDiffOps(worddiff, result);
+	result += "</div>\n";
+}
+
+void InlineDiff::printWordDiffOps(WordDiff & worddiff, String & out)
+{
+	String word;
 	for (unsigned i = 0; i < worddiff.size(); ++i) {
 		DiffOp<Word> & op = worddiff[i];
 		int n, j;
@@ -27,42 +85,41 @@ void InlineDiff::printWordDiff(const String& text1, const String& text2)
 			n = op.from.size();
 			for (j=0; j<n; j++) {
 				op.from[j]->get_whole(word);
-				printText(word);
+				printText(word, out);
 			}
 		} else if (op.op == DiffOp<Word>::del) {
 			n = op.from.size();
-			result += "<del>";
+			out += "<del>";
 			for (j=0; j<n; j++) {
 				op.from[j]->get_whole(word);
-				printText(word);
+				printText(word, out);
 			}
-			result += "</del>";
+			out += "</del>";
 		} else if (op.op == DiffOp<Word>::add) {
 			n = op.to.size();
-			result += "<ins>";
+			out += "<ins>";
 			for (j=0; j<n; j++) {
 				op.to[j]->get_whole(word);
-				printText(word);
+				printText(word, out);
 			}
-			result += "</ins>";
+			out += "</ins>";
 		} else if (op.op == DiffOp<Word>::change) {
 			n = op.from.size();
-			result += "<del>";
+			out += "<del>";
 			for (j=0; j<n; j++) {
 				op.from[j]->get_whole(word);
-				printText(word);
+				printText(word, out);
 			}
-			result += "</del>";
+			out += "</del>";
 			n = op.to.size();
-			result += "<ins>";
+			out += "<ins>";
 			for (j=0; j<n; j++) {
 				op.to[j]->get_whole(word);
-				printText(word);
+				printText(word, out);
 			}
-			result += "</ins>";
+			out += "</ins>";
 		}
 	}
-	result += "</div>\n";
 }
 
 void InlineDiff::printBlockHeader(int leftLine, int rightLine)
@@ -74,12 +131,12 @@ void InlineDiff::printBlockHeader(int leftLine, int rightLine)
 	result += buf;
 }
 
-void InlineDiff::printContext(const String & input)
+void InlineDiff::printContext(const Line & from, const Line & to)
 {
-	printWrappedLine("<div class=\"mw-diff-inline-context\">", input, "</div>\n");
+	printWrappedLine("<div class=\"mw-diff-inline-context\">", to, "</div>\n");
 }
 
-void InlineDiff::printWrappedLine(const char* pre, const String& line, const char* post)
+void InlineDiff::printWrappedLine(const char* pre, const Line & line, const char* post)
 {
 	result += pre;
 	if (line.empty()) {
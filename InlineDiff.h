@@ -6,13 +6,17 @@
 class InlineDiff: public Wikidiff2 {
 	public:
 	protected:
-		void printAdd(const String& line);
-		void printDelete(const String& line);
-		void printWordDiff(const String& text1, const String& text2);
+		void printAdd(const Line & line);
+		void printDelete(const Line & line);
+		void printWordDiff(const Line & text1, const Line & text2, String & out,
+				DiffEngine<Word> & engine);
 		void printBlockHeader(int leftLine, int rightLine);
-		void printContext(const String& input);
+		void printContext(const Line & from, const Line & to);
+		void printMove(const Line & from, const Line & to, bool added, int leftLine,
+				int rightLine);
 
-		void printWrappedLine(const char* pre, const String& line, const char* post);
+		void printWordDiffOps(WordDiff & worddiff, String & out);
+		void printWrappedLine(const char* pre, const Line & line, const char* post);
 };
 
 #endif
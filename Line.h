@@ -0,0 +1,50 @@
+#ifndef LINE_H
+#define LINE_H
+
+#include <string.h>
+#include <stddef.h>
+#include "Wikidiff2.h"
+
+// A line of one of the input texts, stored as a pointer into the caller's
+// buffer, a length and a hash, so that splitting a text into lines copies
+// nothing. The buffer must outlive the line.
+//
+// It has enough of the interface of a string to be printed and split into
+// words like one.
+class Line {
+public:
+	typedef const char * Iterator;
+
+	Line(const char * start_, size_t length_)
+		: start(start_), length(length_), hash(diffHashBytes(start_, start_ + length_))
+	{}
+
+	Iterator begin() const { return start; }
+	Iterator end() const { return start + length; }
+	const char * data() const { return start; }
+	size_t size() const { return length; }
+	bool empty() const { return length == 0; }
+	char operator[](size_t i) const { return start[i]; }
+
+	bool operator== (const Line &l) const {
+		return hash == l.hash && length == l.length && !memcmp(start, l.start, length);
+	}
+	bool operator!=(const Line &l) const {
+		return !operator==(l);
+	}
+
+	const char * start;
+	size_t length;
+	uint32_t hash;
+};
+
+// The hash is computed once, when the line is created
+template<>
+struct DiffHash<Line>
+{
+	uint32_t operator()(const Line & l) const {
+		return l.hash;
+	}
+};
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef LINESKETCH_H
+#define LINESKETCH_H
+
+#include <string.h>
+#include <stdint.h>
+#include "Line.h"
+
+/**
+ * A bottom-k MinHash sketch of a line: the smallest hashes of its
+ * overlapping byte shingles. Comparing the sketches of two lines estimates
+ * the Jaccard similarity of their sets of shingles in constant time,
+ * however long the lines are.
+ *
+ * Similar lines are also likely to share the smallest values of their
+ * sketches, so the first few values can be used to index lines and find
+ * similar ones without comparing every pair.
+ */
+class LineSketch {
+	public:
+		enum {
+			SIZE = 16,
+			// Five bytes is a word or two of most languages, and about two
+			// characters of Chinese or Japanese
+			SHINGLE_LENGTH = 5
+		};
+
+		LineSketch() : count(0) {}
+
+		explicit LineSketch(const Line & line) : count(0) {
+			const unsigned char * p = (const unsigned char*)line.data();
+			size_t n = line.size();
+			if (n < SHINGLE_LENGTH) {
+				if (n) {
+					add(mix(line.hash));
+				}
+				return;
+			}
+			for (size_t i = 0; i + SHINGLE_LENGTH <= n; i++) {
+				uint32_t word;
+				memcpy(&word, p + i, 4);
+				add(mix(word * 0x9e3779b1U + p[i + 4]));
+			}
+		}
+
+		/** Estimate the Jaccard similarity of the lines, from 0 to 1 */
+		double similarity(const LineSketch & other) const {
+			// The smallest values of the union of the two sketches are a
+			// random sample of the union of the shingle sets. Count how many
+			// of them are in both.
+			int i = 0, j = 0, sampled = 0, shared = 0;
+			while (sampled < SIZE && (i < count || j < other.count)) {
+				if (j == other.count || (i < count && values[i] < other.values[j])) {
+					i++;
+				} else if (i == count || other.values[j] < values[i]) {
+					j++;
+				} else {
+					i++;
+					j++;
+					shared++;
+				}
+				sampled++;
+			}
+			return sampled ? (double)shared / sampled : 0;
+		}
+
+		// The smallest distinct hashes, in increasing order
+		uint32_t values[SIZE];
+		int count;
+
+	protected:
+		// The finaliser of MurmurHash3, so that the shingles' hashes are
+		// spread evenly
+		static uint32_t mix(uint32_t h) {
+			h ^= h >> 16;
+			h *= 0x85ebca6b;
+			h ^= h >> 13;
+			h *= 0xc2b2ae35;
+			h ^= h >> 16;
+			return h;
+		}
+
+		void add(uint32_t h) {
+			if (count == SIZE && h >= values[SIZE - 1]) {
+				return;
+			}
+			int i = count < SIZE ? count : SIZE - 1;
+			// Insertion sort, dropping duplicates and the largest value
+			while (i > 0 && values[i - 1] > h) {
+				i--;
+			}
+			if (i > 0 && values[i - 1] == h) {
+				return;
+			}
+			int last = count < SIZE ? count : SIZE - 1;
+			memmove(values + i + 1, values + i, (last - i) * sizeof(uint32_t));
+			values[i] = h;
+			if (count < SIZE) {
+				count++;
+			}
+		}
+};
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef OUTPUTSINK_H
+#define OUTPUTSINK_H
+
+#include <stddef.h>
+#include <functional>
+
+/**
+ * Destination for the rendered diff. Wikidiff2 collects output in its result
+ * buffer, and when a sink is set, hands it over in chunks as it goes, so that
+ * the whole diff never needs to be buffered twice.
+ */
+class OutputSink {
+	public:
+		virtual ~OutputSink() {}
+		virtual void write(const char * data, size_t length) = 0;
+
+		// Called before writing with an estimate of the total length, so that
+		// the destination can be allocated once at about the right size
+		virtual void reserve(size_t length) {}
+};
+
+/**
+ * Output sink which passes each chunk to a callback, e.g. to write it to a
+ * file or socket
+ */
+class CallbackOutputSink : public OutputSink {
+	public:
+		typedef std::function<void(const char *, size_t)> Callback;
+
+		explicit CallbackOutputSink(const Callback & callback_) : callback(callback_) {}
+		void write(const char * data, size_t length) { callback(data, length); }
+
+	protected:
+		Callback callback;
+};
+
+#endif
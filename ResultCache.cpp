@@ -0,0 +1,267 @@
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <random>
+#include <string>
+#include "ResultCache.h"
+
+ResultCache * ResultCache::shared = NULL;
+std::atomic<long long> ResultCache::hits(0);
+std::atomic<long long> ResultCache::misses(0);
+
+// The Mersenne prime 2^61 - 1, the modulus of the text hash
+static const uint64_t HASH_PRIME = (1ULL << 61) - 1;
+
+static inline uint64_t mulModPrime(uint64_t a, uint64_t b)
+{
+	unsigned __int128 product = (unsigned __int128)a * b;
+	uint64_t result = ((uint64_t)product & HASH_PRIME) + (uint64_t)(product >> 61);
+	return result >= HASH_PRIME ? result - HASH_PRIME : result;
+}
+
+static inline size_t alignUp(size_t n, size_t alignment)
+{
+	return (n + alignment - 1) & ~(alignment - 1);
+}
+
+bool ResultCache::init(size_t size)
+{
+	shutdown();
+
+	size_t shardSize = size / NUM_SHARDS & ~(size_t)(ALIGNMENT - 1);
+	size_t numSlots = shardSize / BYTES_PER_SLOT / BUCKET_SIZE * BUCKET_SIZE;
+	size_t dataOffset = alignUp(sizeof(Shard), ALIGNMENT) + numSlots * sizeof(Slot);
+	if (!numSlots || shardSize <= dataOffset) {
+		return false;
+	}
+
+	void * mapped = mmap(NULL, shardSize * NUM_SHARDS, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (mapped == MAP_FAILED) {
+		return false;
+	}
+
+	// The mapping starts out zeroed, so all slots are empty
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+	pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+	for (int i = 0; i < NUM_SHARDS; i++) {
+		Shard * shard = (Shard*)((char*)mapped + i * shardSize);
+		pthread_mutex_init(&shard->mutex, &attr);
+		shard->head = 0;
+	}
+	pthread_mutexattr_destroy(&attr);
+
+	std::random_device random;
+	uint64_t hashBase = (((uint64_t)random() << 32) | random()) % (HASH_PRIME - 256) + 256;
+
+	shared = new ResultCache((char*)mapped, shardSize * NUM_SHARDS, shardSize, numSlots,
+		hashBase);
+	return true;
+}
+
+void ResultCache::shutdown()
+{
+	if (shared) {
+		munmap(shared->base, shared->mappedSize);
+		delete shared;
+		shared = NULL;
+	}
+}
+
+ResultCache::ResultCache(char * base_, size_t mappedSize_, size_t shardSize_, size_t numSlots_,
+		uint64_t hashBase_)
+	: base(base_), mappedSize(mappedSize_), shardSize(shardSize_), numSlots(numSlots_),
+	hashBase(hashBase_)
+{
+	dataSize = shardSize - alignUp(sizeof(Shard), ALIGNMENT) - numSlots * sizeof(Slot);
+}
+
+/**
+ * Hash the text as a polynomial in the secret base, taking four bytes at a
+ * time as the coefficients. Two different texts of at most n bytes collide
+ * with probability at most n/2^63 over the choice of base.
+ */
+uint64_t ResultCache::hashText(const char * text, size_t length) const
+{
+	const unsigned char * p = (const unsigned char*)text;
+	const unsigned char * end = p + length;
+	uint64_t h = 0;
+	for (; end - p >= 4; p += 4) {
+		uint32_t chunk;
+		memcpy(&chunk, p, 4);
+		h = mulModPrime(h, hashBase) + chunk;
+		h = h >= HASH_PRIME ? h - HASH_PRIME : h;
+	}
+	uint32_t tail = 0;
+	memcpy(&tail, p, end - p);
+	h = mulModPrime(h, hashBase) + tail;
+	return h >= HASH_PRIME ? h - HASH_PRIME : h;
+}
+
+ResultCache::Key ResultCache::makeKey(const char * text1, size_t length1, const char * text2,
+		size_t length2, int format, int numContextLines, int algorithm, long long maxWork,
+		int approximateThreshold, bool detectMoves) const
+{
+	Key key;
+	// Zero any padding, since keys are compared with memcmp()
+	memset(&key, 0, sizeof(key));
+	key.hash1 = hashText(text1, length1);
+	key.hash2 = hashText(text2, length2);
+	key.length1 = length1;
+	key.length2 = length2;
+	key.numContextLines = numContextLines;
+	key.maxWork = maxWork;
+	key.approximateThreshold = approximateThreshold;
+	key.format = format;
+	key.algorithm = algorithm;
+	key.detectMoves = detectMoves;
+	return key;
+}
+
+ResultCache::Shard & ResultCache::getShard(const Key & key)
+{
+	uint64_t h = key.hash1 ^ (key.hash2 * 0x9e3779b97f4a7c15ULL);
+	return *(Shard*)(base + (h >> 32) % NUM_SHARDS * shardSize);
+}
+
+ResultCache::Slot * ResultCache::getBucket(Shard & shard, const Key & key)
+{
+	uint64_t h = key.hash1 ^ (key.hash2 * 0x9e3779b97f4a7c15ULL)
+		^ ((uint64_t)key.format << 8) ^ (uint64_t)key.numContextLines;
+	Slot * slots = (Slot*)((char*)&shard + alignUp(sizeof(Shard), ALIGNMENT));
+	return slots + h % (numSlots / BUCKET_SIZE) * BUCKET_SIZE;
+}
+
+char * ResultCache::getData(Shard & shard)
+{
+	return (char*)&shard + (shardSize - dataSize);
+}
+
+/**
+ * Lock the shard. If a process died while holding the lock, the shard may
+ * have been left half written, so it is emptied.
+ */
+bool ResultCache::lockShard(Shard & shard)
+{
+	int error = pthread_mutex_lock(&shard.mutex);
+	if (error == EOWNERDEAD) {
+		resetShard(shard);
+		pthread_mutex_consistent(&shard.mutex);
+		return true;
+	}
+	return error == 0;
+}
+
+void ResultCache::resetShard(Shard & shard)
+{
+	Slot * slots = (Slot*)((char*)&shard + alignUp(sizeof(Shard), ALIGNMENT));
+	memset(slots, 0, numSlots * sizeof(Slot));
+}
+
+// A result is valid until the head has gone once around the ring past it
+bool ResultCache::isValid(Shard & shard, const Slot & slot)
+{
+	return slot.used && slot.offset + dataSize >= shard.head;
+}
+
+// Find where a result of the given length would be appended. A result never
+// wraps around the end of the ring, so if there is not enough room before
+// the end, it goes at the start.
+uint64_t ResultCache::nextOffset(Shard & shard, size_t length)
+{
+	uint64_t offset = shard.head;
+	if (offset % dataSize + length > dataSize) {
+		offset += dataSize - offset % dataSize;
+	}
+	return offset;
+}
+
+bool ResultCache::lookup(const Key & key, OutputSink & sink)
+{
+	Shard & shard = getShard(key);
+	std::string result;
+	{
+		ShardLock lock(*this, shard);
+		if (!lock.locked) {
+			misses++;
+			return false;
+		}
+		Slot * bucket = getBucket(shard, key);
+		Slot * slot = NULL;
+		for (int i = 0; i < BUCKET_SIZE; i++) {
+			if (isValid(shard, bucket[i]) && !memcmp(&bucket[i].key, &key, sizeof(key))) {
+				slot = &bucket[i];
+				break;
+			}
+		}
+		if (!slot) {
+			misses++;
+			return false;
+		}
+
+		// Copy it out, so that the lock is not held while the sink allocates
+		char * data = getData(shard);
+		result.assign(data + slot->offset % dataSize, slot->length);
+
+		// Move a result from the older half of the ring back to the head,
+		// unless it is so old that the move would overwrite it
+		if (slot->offset + dataSize / 2 < shard.head) {
+			uint64_t offset = nextOffset(shard, slot->length);
+			if (slot->offset + dataSize >= offset + slot->length) {
+				memcpy(data + offset % dataSize, result.data(), slot->length);
+				slot->offset = offset;
+				shard.head = offset + slot->length;
+			}
+		}
+	}
+	hits++;
+	sink.reserve(result.size());
+	sink.write(result.data(), result.size());
+	return true;
+}
+
+void ResultCache::store(const Key & key, const char * data, size_t length)
+{
+	// Don't let one huge result flush everything else
+	if (length > dataSize / 4) {
+		return;
+	}
+	Shard & shard = getShard(key);
+	ShardLock lock(*this, shard);
+	if (!lock.locked) {
+		return;
+	}
+
+	// Use the slot with the same key, or an empty one, or else the one with
+	// the oldest result
+	Slot * bucket = getBucket(shard, key);
+	Slot * slot = NULL;
+	for (int i = 0; i < BUCKET_SIZE && !slot; i++) {
+		if (bucket[i].used && !memcmp(&bucket[i].key, &key, sizeof(key))) {
+			slot = &bucket[i];
+		}
+	}
+	for (int i = 0; i < BUCKET_SIZE && !slot; i++) {
+		if (!isValid(shard, bucket[i])) {
+			slot = &bucket[i];
+		}
+	}
+	if (!slot) {
+		slot = &bucket[0];
+		for (int i = 1; i < BUCKET_SIZE; i++) {
+			if (bucket[i].offset < slot->offset) {
+				slot = &bucket[i];
+			}
+		}
+	}
+
+	uint64_t offset = nextOffset(shard, length);
+	memcpy(getData(shard) + offset % dataSize, data, length);
+	slot->key = key;
+	slot->offset = offset;
+	slot->length = length;
+	slot->used = 1;
+	shard.head = offset + length;
+}
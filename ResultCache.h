@@ -0,0 +1,130 @@
+#ifndef RESULTCACHE_H
+#define RESULTCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <atomic>
+#include "OutputSink.h"
+
+/**
+ * A cache of whole diff results in an anonymous shared memory mapping. It is
+ * created at module startup, before the server forks its workers, so that
+ * all of them see the same cache and a diff computed by one worker is
+ * served to the others.
+ *
+ * The cache is split into shards, each with its own process-shared mutex,
+ * slot table and data area. The data area is a ring: results are appended
+ * at the head, and overwrite the oldest ones. A hit on a result in the older
+ * half of the ring copies it back to the head, so that results which are
+ * still being read survive, which approximates LRU eviction.
+ *
+ * Results are keyed by hashes of the two texts and by every option which
+ * changes the output. The texts are hashed with a polynomial hash whose base
+ * is chosen randomly when the cache is created, so that collisions can't be
+ * constructed on purpose.
+ *
+ * The hit and miss counts are kept by each process, not in the shared
+ * mapping, so they are totals for the calling process only.
+ */
+class ResultCache {
+	public:
+		// Output formats, which are cached separately
+		enum Format { FORMAT_TABLE = 0, FORMAT_INLINE = 1, FORMAT_EDIT_SCRIPT = 2 };
+
+		struct Key {
+			uint64_t hash1, hash2;
+			uint64_t length1, length2;
+			int64_t numContextLines, maxWork, approximateThreshold;
+			int32_t format, algorithm, detectMoves;
+		};
+
+		/**
+		 * Create the cache with the given total size in bytes. It must be
+		 * called before forking for the processes to share it. Returns false
+		 * if the size is zero or the memory could not be mapped.
+		 */
+		static bool init(size_t size);
+		static void shutdown();
+
+		/** The process's cache, or NULL if it is disabled */
+		static ResultCache * getShared() { return shared; }
+
+		static long long getHits() { return hits; }
+		static long long getMisses() { return misses; }
+
+		Key makeKey(const char * text1, size_t length1, const char * text2, size_t length2,
+				int format, int numContextLines, int algorithm, long long maxWork,
+				int approximateThreshold, bool detectMoves) const;
+
+		/** Write the cached result for the key to the sink, if there is one */
+		bool lookup(const Key & key, OutputSink & sink);
+
+		void store(const Key & key, const char * data, size_t length);
+
+	protected:
+		enum {
+			NUM_SHARDS = 16,
+			// Slots per bucket of the slot table
+			BUCKET_SIZE = 4,
+			// Average result size assumed when sizing the slot table
+			BYTES_PER_SLOT = 2048,
+			ALIGNMENT = 64
+		};
+
+		struct Slot {
+			Key key;
+			// Position of the result in the shard's ring, counting every byte
+			// ever appended
+			uint64_t offset;
+			uint64_t length;
+			uint64_t used;
+		};
+
+		struct Shard {
+			pthread_mutex_t mutex;
+			// Number of bytes ever appended to the ring
+			uint64_t head;
+		};
+
+		/** Holds the lock of a shard while it is in scope */
+		class ShardLock {
+			public:
+				ShardLock(ResultCache & cache, Shard & shard_)
+					: shard(shard_), locked(cache.lockShard(shard_)) {}
+				~ShardLock() {
+					if (locked) {
+						pthread_mutex_unlock(&shard.mutex);
+					}
+				}
+				Shard & shard;
+				bool locked;
+		};
+
+		ResultCache(char * base_, size_t mappedSize_, size_t shardSize_, size_t numSlots_,
+				uint64_t hashBase_);
+
+		uint64_t hashText(const char * text, size_t length) const;
+
+		Shard & getShard(const Key & key);
+		Slot * getBucket(Shard & shard, const Key & key);
+		char * getData(Shard & shard);
+		bool lockShard(Shard & shard);
+		void resetShard(Shard & shard);
+
+		bool isValid(Shard & shard, const Slot & slot);
+		uint64_t nextOffset(Shard & shard, size_t length);
+
+		static ResultCache * shared;
+		static std::atomic<long long> hits;
+		static std::atomic<long long> misses;
+
+		char * base;
+		size_t mappedSize;
+		size_t shardSize;
+		size_t numSlots;
+		size_t dataSize;
+		uint64_t hashBase;
+};
+
+#endif
@@ -1,8 +1,9 @@
 #include <stdio.h>
 #include "Wikidiff2.h"
 #include "TableDiff.h"
+#include "WordDiffCache.h"
 
-void TableDiff::printAdd(const String & line)
+void TableDiff::printAdd(const Line & line)
 {
 	result += "<tr>\n"
 		"  <td colspan=\"2\" class=\"diff-empty\">&#160;</td>\n"
@@ -12,7 +13,7 @@ void TableDiff::printAdd(const String & line)
 	result += "</td>\n</tr>\n";
 }
 
-void TableDiff::printDelete(const String & line)
+void TableDiff::printDelete(const Line & line)
 {
 	result += "<tr>\n"
 		"  <td class=\"diff-marker\">−</td>\n"
@@ -23,30 +24,88 @@ void TableDiff::printDelete(const String & line)
 		"</tr>\n";
 }
 
-void TableDiff::printWordDiff(const String & text1, const String & text2)
+void TableDiff::printWordDiff(const Line & text1, const Line & text2, String & out,
+		DiffEngine<Word> & engine)
 {
+	// The cache is skipped under a work limit, since a cached diff could be
+	// more detailed than the limit would allow
+	WordDiffCache & cache = WordDiffCache::current();
+	bool useCache = WordDiffCache::enabled() && !budget.limit;
+	if (useCache) {
+		const std::string * cached = cache.lookup(WordDiffCache::FORMAT_TABLE, algorithm,
+			text1, text2);
+		if (cached) {
+			out.append(cached->data(), cached->size());
+			return;
+		}
+	}
+	size_t start = out.size();
+
 	WordVector words1, words2;
 
 	explodeWords(text1, words1);
 	explodeWords(text2, words2);
-	WordDiff worddiff(words1, words2, MAX_WORD_LEVEL_DIFF_COMPLEXITY);
+	WordDiff worddiff(words1, words2, MAX_WORD_LEVEL_DIFF_COMPLEXITY, algorithm, &budget,
+		false, NULL, &engine);
 
 	//debugPrintWordDiff(worddiff);
 
 	// print twice; first for left side, then for right side
-	result += "<tr>\n"
+	out += "<tr>\n"
 		"  <td class=\"diff-marker\">−</td>\n"
 		"  <td class=\"diff-deletedline\"><div>";
-	printWordDiffSide(worddiff, false);
-	result += "</div></td>\n"
+	printWordDiffSide(worddiff, false, out);
+	out += "</div></td>\n"
 		"  <td class=\"diff-marker\">+</td>\n"
 		"  <td class=\"diff-addedline\"><div>";
-	printWordDiffSide(worddiff, true);
-	result += "</div></td>\n"
+	printWordDiffSide(worddiff, true, out);
+	out += "</div></td>\n"
 		"</tr>\n";
+
+	if (useCache) {
+		cache.store(WordDiffCache::FORMAT_TABLE, algorithm, text1, text2,
+			out.data() + start, out.size() - start);
+	}
+}
+
+void TableDiff::printMove(const Line & from, const Line & to, bool added, int leftLine,
+		int rightLine)
+{
+	WordVector words1, words2;
+	explodeWords(from, words1);
+	explodeWords(to, words2);
+	WordDiff worddiff(words1, words2, MAX_WORD_LEVEL_DIFF_COMPLEXITY, algorithm, &budget,
+		false, NULL, &wordEngine);
+
+	char buf[512]; // should be plenty
+	if (!added) {
+		snprintf(buf, sizeof(buf),
+			"<tr>\n"
+			"  <td class=\"diff-marker\"><a class=\"mw-diff-movedpara-left\" "
+				"href=\"#movedpara_%u_%u_rhs\">&#x26AB;</a></td>\n"
+			"  <td class=\"diff-deletedline\"><div><a name=\"movedpara_%u_%u_lhs\"></a>",
+			leftLine, rightLine, leftLine, rightLine);
+		result += buf;
+		printWordDiffSide(worddiff, false, result);
+		result += "</div></td>\n"
+			"  <td colspan=\"2\" class=\"diff-empty\">&#160;</td>\n"
+			"</tr>\n";
+	} else {
+		snprintf(buf, sizeof(buf),
+			"<tr>\n"
+			"  <td colspan=\"2\" class=\"diff-empty\">&#160;</td>\n"
+			"  <td class=\"diff-marker\"><a class=\"mw-diff-movedpara-right\" "
+				"href=\"#movedpara_%u_%u_lhs\">&#x26AB;</a></td>\n"
+			"  <td class=\"diff-addedline\"><div><a name=\"movedpara_%u_%u_rhs\"></a>",
+			leftLine, rightLine, leftLine, rightLine);
+		result += buf;
+		printWordDiffSide(worddiff, true, result);
+		result += "</div></td>\n"
+			"</tr>\n";
+	}
 }
 
-void TableDiff::printWordDiffSide(WordDiff &worddiff, bool added)
+void TableDiff::printWordDiffSide(WordDiff &worddiff, bool added, String & out)
 {
 	String word;
 	for (unsigned i = 0; i < worddiff.size(); ++i) {
@@ -57,35 +116,35 @@ void TableDiff::printWordDiffSide(WordDiff &worddiff, bool added)
 			if (added) {
 				for (j=0; j<n; j++) {
 					op.to[j]->get_whole(word);
-					printText(word);
+					printText(word, out);
 				}
 			} else {
 				for (j=0; j<n; j++) {
 					op.from[j]->get_whole(word);
-					printText(word);
+					printText(word, out);
 				}
 			}
 		} else if (!added && (op.op == DiffOp<Word>::del || op.op == DiffOp<Word>::change)) {
 			n = op.from.size();
-			result += "<del class=\"diffchange diffchange-inline\">";
+			out += "<del class=\"diffchange diffchange-inline\">";
 			for (j=0; j<n; j++) {
 				op.from[j]->get_whole(word);
-				printText(word);
+				printText(word, out);
 			}
-			result += "</del>";
+			out += "</del>";
 		} else if (added && (op.op == DiffOp<Word>::add || op.op == DiffOp<Word>::change)) {
 			n = op.to.size();
-			result += "<ins class=\"diffchange diffchange-inline\">";
+			out += "<ins class=\"diffchange diffchange-inline\">";
 			for (j=0; j<n; j++) {
 				op.to[j]->get_whole(word);
-				printText(word);
+				printText(word, out);
 			}
-			result += "</ins>";
+			out += "</ins>";
 		}
 	}
 }
 
-void TableDiff::printTextWithDiv(const String & input)
+void TableDiff::printTextWithDiv(const Line & input)
 {
 	// Wrap string in a <div> if it's not empty
 	if (input.size() > 0) {
@@ -107,17 +166,17 @@ void TableDiff::printBlockHeader(int leftLine, int rightLine)
 	result += buf;
 }
 
-void TableDiff::printContext(const String & input)
+void TableDiff::printContext(const Line & from, const Line & to)
 {
 	result +=
 		"<tr>\n"
 		"  <td class=\"diff-marker\">&#160;</td>\n"
 		"  <td class=\"diff-context\">";
-	printTextWithDiv(input);
+	printTextWithDiv(from);
 	result +=
 		"</td>\n"
 		"  <td class=\"diff-marker\">&#160;</td>\n"
 		"  <td class=\"diff-context\">";
-	printTextWithDiv(input);
+	printTextWithDiv(to);
 	result += "</td>\n</tr>\n";
 }
@@ -6,14 +6,17 @@
 class TableDiff: public Wikidiff2 {
 	public:
 	protected:
-		void printAdd(const String& line);
-		void printDelete(const String& line);
-		void printWordDiff(const String& text1, const String & text2);
-		void printTextWithDiv(const String& input);
+		void printAdd(const Line & line);
+		void printDelete(const Line & line);
+		void printWordDiff(const Line & text1, const Line & text2, String & out,
+				DiffEngine<Word> & engine);
+		void printTextWithDiv(const Line & input);
 		void printBlockHeader(int leftLine, int rightLine);
-		void printContext(const String& input);
+		void printContext(const Line & from, const Line & to);
+		void printMove(const Line & from, const Line & to, bool added, int leftLine,
+				int rightLine);
 
-		void printWordDiffSide(WordDiff& worddiff, bool added);
+		void printWordDiffSide(WordDiff& worddiff, bool added, String & out);
 };
 
 #endif
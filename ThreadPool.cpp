@@ -0,0 +1,145 @@
+#include "ThreadPool.h"
+
+thread_local int ThreadPool::workerIndex = 0;
+
+ThreadPool::ThreadPool(int numThreads)
+	: queued(0), stopping(false)
+{
+	for (int i = 0; i <= numThreads; i++) {
+		queues.push_back(std::unique_ptr<Queue>(new Queue));
+	}
+	for (int i = 1; i <= numThreads; i++) {
+		workers.push_back(std::thread(&ThreadPool::workerMain, this, i));
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		stopping = true;
+	}
+	wakeup.notify_all();
+	for (size_t i = 0; i < workers.size(); i++) {
+		workers[i].join();
+	}
+}
+
+ThreadPool & ThreadPool::getShared(int numThreads)
+{
+	static ThreadPool pool(numThreads);
+	return pool;
+}
+
+void ThreadPool::submit(TaskGroup & group, const Task & task)
+{
+	Queue & queue = *queues[workerIndex];
+	group.pending++;
+	{
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.jobs.push_back(Job(&group, task));
+	}
+	{
+		// Increment under the lock so that a worker about to sleep sees it
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		queued++;
+	}
+	wakeup.notify_one();
+}
+
+void ThreadPool::wait(TaskGroup & group)
+{
+	Job job;
+	TaskGroup * only = workerIndex ? NULL : &group;
+	while (group.pending > 0 && takeJob(workerIndex, only, job)) {
+		runJob(job);
+	}
+	// The rest of the group's tasks are running on other threads. Take the
+	// lock even if they are done, so that the last of them has let go of
+	// the group before it is destroyed.
+	{
+		std::unique_lock<std::mutex> lock(group.mutex);
+		group.finished.wait(lock, [&group] { return group.pending == 0; });
+	}
+	if (group.exception) {
+		std::exception_ptr e = group.exception;
+		group.exception = std::exception_ptr();
+		std::rethrow_exception(e);
+	}
+}
+
+void ThreadPool::workerMain(int index)
+{
+	workerIndex = index;
+	Job job;
+	while (1) {
+		if (takeJob(index, NULL, job)) {
+			runJob(job);
+			continue;
+		}
+		std::unique_lock<std::mutex> lock(sleepMutex);
+		wakeup.wait(lock, [this] { return queued > 0 || stopping; });
+		if (stopping) {
+			return;
+		}
+	}
+}
+
+/**
+ * Take a job from the back of our own queue, or failing that, steal one from
+ * the front of another queue. If group is given, only a job of that group is
+ * taken, the most recently submitted first.
+ */
+bool ThreadPool::takeJob(int index, TaskGroup * group, Job & job)
+{
+	int n = (int)queues.size();
+	for (int i = 0; i < n; i++) {
+		int victim = (index + i) % n;
+		Queue & queue = *queues[victim];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (queue.jobs.empty()) {
+			continue;
+		}
+		if (group) {
+			std::deque<Job>::iterator it = queue.jobs.end();
+			while (it != queue.jobs.begin()) {
+				--it;
+				if (it->group == group) {
+					job = *it;
+					queue.jobs.erase(it);
+					queued--;
+					return true;
+				}
+			}
+			continue;
+		}
+		if (i == 0) {
+			job = queue.jobs.back();
+			queue.jobs.pop_back();
+		} else {
+			job = queue.jobs.front();
+			queue.jobs.pop_front();
+		}
+		queued--;
+		return true;
+	}
+	return false;
+}
+
+void ThreadPool::runJob(Job & job)
+{
+	TaskGroup & group = *job.group;
+	try {
+		job.task();
+	} catch (...) {
+		std::lock_guard<std::mutex> lock(group.exceptionMutex);
+		if (!group.exception) {
+			group.exception = std::current_exception();
+		}
+	}
+	job.task = Task();
+	std::lock_guard<std::mutex> lock(group.mutex);
+	if (--group.pending == 0) {
+		group.finished.notify_all();
+	}
+}
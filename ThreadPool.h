@@ -0,0 +1,109 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * A work-stealing thread pool for fork/join parallelism.
+ *
+ * Each worker has its own task queue. A worker takes tasks from the back of
+ * its own queue (most recently submitted first), and when that is empty,
+ * steals from the front of the other queues. Tasks submitted by threads
+ * outside the pool go into a shared queue.
+ *
+ * Tasks are submitted as part of a TaskGroup, and wait() blocks until every
+ * task in the group has finished. The waiting thread runs queued tasks
+ * meanwhile, so a task may itself submit tasks and wait for them. A pool
+ * worker may run any task, but a thread outside the pool only runs the tasks
+ * of the group it is waiting for, since the tasks of another request may use
+ * scratch space which only that request's thread may touch. Once there is
+ * nothing it may run, the waiting thread sleeps until the group is done.
+ *
+ * Tasks run on threads which are not known to PHP, so they must not call
+ * emalloc() or any other PHP API. PhpAllocator uses malloc() on these threads,
+ * so memory allocated through it must be freed before the task returns.
+ */
+class ThreadPool {
+	public:
+		typedef std::function<void()> Task;
+
+		class TaskGroup {
+			public:
+				TaskGroup() : pending(0) {}
+			protected:
+				friend class ThreadPool;
+				std::atomic<int> pending;
+				std::exception_ptr exception;
+				std::mutex exceptionMutex;
+				// Signalled, under mutex, when pending reaches zero
+				std::mutex mutex;
+				std::condition_variable finished;
+		};
+
+		explicit ThreadPool(int numThreads);
+		~ThreadPool();
+
+		/**
+		 * Get the process-wide pool, creating it with the given number of
+		 * threads on first use. It is created lazily, rather than at module
+		 * startup, so that it exists in forked worker processes.
+		 */
+		static ThreadPool & getShared(int numThreads);
+
+		/** The number of worker threads */
+		int size() const { return (int)workers.size(); }
+
+		/**
+		 * The index of the pool worker running the calling thread, from 1 to
+		 * size(), or 0 if the caller is not a pool worker.
+		 */
+		static int currentWorker() { return workerIndex; }
+
+		void submit(TaskGroup & group, const Task & task);
+
+		/**
+		 * Wait for all tasks in the group to finish, running tasks while
+		 * waiting. All the group's tasks must have been submitted first. If
+		 * a task threw an exception, it is rethrown here.
+		 */
+		void wait(TaskGroup & group);
+
+	protected:
+		struct Job {
+			Job() : group(NULL) {}
+			Job(TaskGroup * group_, const Task & task_) : group(group_), task(task_) {}
+			TaskGroup * group;
+			Task task;
+		};
+
+		struct Queue {
+			std::mutex mutex;
+			std::deque<Job> jobs;
+		};
+
+		void workerMain(int index);
+		bool takeJob(int index, TaskGroup * group, Job & job);
+		void runJob(Job & job);
+
+		// Queue 0 is for submissions from outside the pool, queue i for worker i
+		std::vector<std::unique_ptr<Queue> > queues;
+		std::vector<std::thread> workers;
+
+		// Number of jobs in all queues, used to put idle workers to sleep
+		std::atomic<int> queued;
+		std::mutex sleepMutex;
+		std::condition_variable wakeup;
+		bool stopping;
+
+		static thread_local int workerIndex;
+};
+
+#endif
@@ -8,48 +8,123 @@
 #include <stdio.h>
 #include <string.h>
 #include "Wikidiff2.h"
+#include "DiffSession.h"
 #include <thai/thailib.h>
 #include <thai/thwchar.h>
 #include <thai/thbrk.h>
 
 
-void Wikidiff2::diffLines(const StringVector & lines1, const StringVector & lines2,
-		int numContextLines)
+/**
+ * Diff the given lines and render the result. The lines may be a window of
+ * the full texts with the common prefix and suffix trimmed away, in which
+ * case lineOffset is the number of lines trimmed from the start, and
+ * trimmedStart/trimmedEnd say which ends were trimmed.
+ *
+ * If boundary shifting in the diff engine moved a change so close to a
+ * trimmed end that fewer than numContextLines unchanged lines remain there,
+ * the shift may have been cut short and the context would be incomplete. In
+ * that case nothing is rendered and false is returned, and the caller should
+ * diff the full texts instead.
+ */
+bool Wikidiff2::diffLines(const LineVector & lines1, const LineVector & lines2,
+		int numContextLines, int lineOffset /* = 0 */, bool trimmedStart /* = false */,
+		bool trimmedEnd /* = false */)
 {
 	// first do line-level diff
-	StringDiff linediff(lines1, lines2);
+	bool approximate = approximateThreshold > 0
+		&& lines1.size() + lines2.size() > (size_t)approximateThreshold;
+	LineDiff linediff(lines1, lines2, 0, algorithm, &budget, approximate, pool, &lineEngine);
+
+	if (linediff.size()) {
+		DiffOp<Line> & first = linediff[0];
+		DiffOp<Line> & last = linediff[linediff.size() - 1];
+		if ((trimmedStart && (first.op != DiffOp<Line>::copy
+					|| first.from.size() < std::max(numContextLines, 1)))
+			|| (trimmedEnd && (last.op != DiffOp<Line>::copy
+					|| last.from.size() < std::max(numContextLines, 1))))
+		{
+			return false;
+		}
+	}
+
+	printLineDiff(lines1, lines2, linediff, numContextLines, lineOffset);
+	return true;
+}
 
-	int from_index = 1, to_index = 1;
+/**
+ * Render a line diff of the given lines, which may be a window of the full
+ * texts starting lineOffset lines in
+ */
+void Wikidiff2::printLineDiff(const LineVector & lines1, const LineVector & lines2,
+		LineDiff & linediff, int numContextLines, int lineOffset)
+{
+	// For each old line of a change, the new line it is word-diffed with, and
+	// vice versa, or -1
+	IndexVector pairedTo(lines1.size(), -1), pairedFrom(lines2.size(), -1);
+	pairChangedLines(linediff, pairedTo, pairedFrom);
+
+	// The word diffs of changed lines are independent of each other, so with
+	// a thread pool, start them all now and collect them as rendering reaches
+	// them
+	WordDiffJobList jobs(pool);
+	if (pool) {
+		startWordDiffs(lines1, lines2, linediff, pairedTo, jobs);
+	}
+
+	// For each deleted line, the index of the added line it moved to, and
+	// vice versa, or -1
+	IndexVector movedTo, movedFrom;
+	if (detectMoves) {
+		movedTo.assign(lines1.size(), -1);
+		movedFrom.assign(lines2.size(), -1);
+		findMoves(lines1, linediff, pairedTo, pairedFrom, movedTo, movedFrom);
+	}
+
+	int from_index = 1 + lineOffset, to_index = 1 + lineOffset;
 
 	// Should a line number be printed before the next context line?
 	// Set to true initially so we get a line number on line 1
 	bool showLineNumber = true;
+	// The number of word diffs printed so far
+	int pair = 0;
 
 	for (int i = 0; i < linediff.size(); ++i) {
-		int n, j, n1, n2;
+		int n, j, k, n1, n2;
 		// Line 1 changed, show heading with no leading context
-		if (linediff[i].op != DiffOp<String>::copy && i == 0) {
+		if (linediff[i].op != DiffOp<Line>::copy && i == 0) {
 			printBlockHeader(1, 1);
 		}
 
 		switch (linediff[i].op) {
-			case DiffOp<String>::add:
+			case DiffOp<Line>::add:
 				// inserted lines
 				n = linediff[i].to.size();
 				for (j=0; j<n; j++) {
-					printAdd(*linediff[i].to[j]);
+					int from = detectMoves ? movedFrom[linediff[i].to.start + j] : -1;
+					if (from >= 0) {
+						printMove(lines1[from], *linediff[i].to[j], true,
+							from + 1 + lineOffset, linediff[i].to.start + j + 1 + lineOffset);
+					} else {
+						printAdd(*linediff[i].to[j]);
+					}
 				}
 				to_index += n;
 				break;
-			case DiffOp<String>::del:
+			case DiffOp<Line>::del:
 				// deleted lines
 				n = linediff[i].from.size();
 				for (j=0; j<n; j++) {
-					printDelete(*linediff[i].from[j]);
+					int to = detectMoves ? movedTo[linediff[i].from.start + j] : -1;
+					if (to >= 0) {
+						printMove(*linediff[i].from[j], lines2[to], false,
+							linediff[i].from.start + j + 1 + lineOffset, to + 1 + lineOffset);
+					} else {
+						printDelete(*linediff[i].from[j]);
+					}
 				}
 				from_index += n;
 				break;
-			case DiffOp<String>::copy:
+			case DiffOp<Line>::copy:
 				// copy/context
 				n = linediff[i].from.size();
 				for (j=0; j<n; j++) {
@@ -59,7 +134,7 @@ void Wikidiff2::diffLines(const StringVector & lines1, const StringVector & line
 							printBlockHeader(from_index, to_index);
 							showLineNumber = false;
 						}
-						printContext(*linediff[i].from[j]);
+						printContext(*linediff[i].from[j], *linediff[i].to[j]);
 					} else {
 						showLineNumber = true;
 					}
@@ -67,29 +142,311 @@ void Wikidiff2::diffLines(const StringVector & lines1, const StringVector & line
 					to_index++;
 				}
 				break;
-			case DiffOp<String>::change:
-				// replace, i.e. we do a word diff between the two sets of lines
+			case DiffOp<Line>::change:
+				// replace, i.e. we do a word diff between the paired lines, and
+				// show the others as deleted or added
 				n1 = linediff[i].from.size();
 				n2 = linediff[i].to.size();
-				n = std::min(n1, n2);
-				for (j=0; j<n; j++) {
-					printWordDiff(*linediff[i].from[j], *linediff[i].to[j]);
+				j = k = 0;
+				while (j < n1 || k < n2) {
+					int from = linediff[i].from.start + j;
+					int to = linediff[i].to.start + k;
+					if (j < n1 && k < n2 && pairedTo[from] == to) {
+						if (pool) {
+							finishWordDiff(pair, jobs);
+						} else {
+							printWordDiff(lines1[from], lines2[to], result, wordEngine);
+						}
+						pair++;
+						j++;
+						k++;
+					} else if (j < n1 && (k == n2 || pairedTo[from] < 0)) {
+						int movedLine = detectMoves ? movedTo[from] : -1;
+						if (movedLine >= 0) {
+							printMove(lines1[from], lines2[movedLine], false,
+								from + 1 + lineOffset, movedLine + 1 + lineOffset);
+						} else {
+							printDelete(lines1[from]);
+						}
+						j++;
+					} else {
+						int movedLine = detectMoves ? movedFrom[to] : -1;
+						if (movedLine >= 0) {
+							printMove(lines1[movedLine], lines2[to], true,
+								movedLine + 1 + lineOffset, to + 1 + lineOffset);
+						} else {
+							printAdd(lines2[to]);
+						}
+						k++;
+					}
 				}
+				n = std::min(n1, n2);
 				from_index += n;
 				to_index += n;
-				if (n1 > n2) {
-					for (j=n2; j<n1; j++) {
-						printDelete(*linediff[i].from[j]);
-					}
-				} else {
-					for (j=n1; j<n2; j++) {
-						printAdd(*linediff[i].to[j]);
-					}
-				}
 				break;
 		}
 		// Not first line anymore, don't show line number by default
 		showLineNumber = false;
+		flushOutput(false);
+	}
+}
+
+/**
+ * Choose which lines of each change are shown as a word diff, and set
+ * pairedTo and pairedFrom, indexed by line, to the line each is paired with.
+ * Lines left unpaired are shown as deleted or added.
+ *
+ * Pairing the lines of a change by position goes wrong as soon as a line is
+ * inserted or removed near its start: every later pair is of unrelated
+ * lines, whose word diffs are slow and show nearly everything as changed.
+ * Instead, the lines are aligned, keeping their order, so as to maximise
+ * their similarity, estimated from their sketches. Lines which are not
+ * related to any other are still paired by position, as before.
+ *
+ * The alignment takes time in proportion to the product of the numbers of
+ * old and new lines, so changes too big for it are paired by position, as
+ * are all changes once the work limit has been reached.
+ */
+void Wikidiff2::pairChangedLines(LineDiff & linediff, IndexVector & pairedTo,
+		IndexVector & pairedFrom)
+{
+	SketchVector sketches1, sketches2;
+	IndexVector scores;
+	for (size_t i = 0; i < linediff.size(); ++i) {
+		DiffOp<Line> & op = linediff[i];
+		if (op.op != DiffOp<Line>::change) {
+			continue;
+		}
+		int n1 = op.from.size(), n2 = op.to.size();
+		if ((size_t)(n1 + 1) * (n2 + 1) > MAX_PAIRING_CELLS || budget.exhausted()) {
+			for (int j = 0; j < std::min(n1, n2); j++) {
+				pairedTo[op.from.start + j] = op.to.start + j;
+				pairedFrom[op.to.start + j] = op.from.start + j;
+			}
+			continue;
+		}
+
+		sketches1.clear();
+		sketches2.clear();
+		for (int j = 0; j < n1; j++) {
+			sketches1.push_back(LineSketch(*op.from[j]));
+		}
+		for (int k = 0; k < n2; k++) {
+			sketches2.push_back(LineSketch(*op.to[k]));
+		}
+
+		// scores[j * width + k] is the best score of an alignment of the
+		// first j old lines with the first k new lines
+		int width = n2 + 1;
+		budget.spend((long long)n1 * n2);
+		scores.assign((size_t)(n1 + 1) * width, 0);
+		for (int j = 1; j <= n1; j++) {
+			for (int k = 1; k <= n2; k++) {
+				int skip = std::max(scores[(j - 1) * width + k], scores[j * width + k - 1]);
+				int paired = scores[(j - 1) * width + k - 1]
+					+ pairScore(sketches1[j - 1], sketches2[k - 1]);
+				scores[j * width + k] = std::max(skip, paired);
+			}
+		}
+
+		// Trace the alignment back from the end. Where leaving a line
+		// unpaired scores as well as pairing it, do that, so that unrelated
+		// lines left over are at the end, as when pairing by position.
+		int j = n1, k = n2;
+		while (j > 0 && k > 0) {
+			int score = scores[j * width + k];
+			if (score == scores[(j - 1) * width + k]) {
+				j--;
+			} else if (score == scores[j * width + k - 1]) {
+				k--;
+			} else {
+				j--;
+				k--;
+				pairedTo[op.from.start + j] = op.to.start + k;
+				pairedFrom[op.to.start + k] = op.from.start + j;
+			}
+		}
+	}
+}
+
+const double Wikidiff2::MIN_MOVE_SIMILARITY = 0.5;
+
+/**
+ * Find the lines which were moved, i.e. deleted in one place and added in
+ * another, and set movedTo and movedFrom, indexed by line, to the other end
+ * of each move. The deleted and added lines are those of del and add ops, and
+ * those left over after pairing the lines of a change.
+ *
+ * Comparing every deleted line with every added line would take quadratic
+ * time. Instead, each long enough deleted line is sketched, and indexed by
+ * the two smallest values of its sketch, which a similar line is likely to
+ * share. Each added line is then only compared with the deleted lines
+ * sharing one of its own two smallest values, by sketch, and the most
+ * similar is confirmed with a bounded word diff.
+ */
+void Wikidiff2::findMoves(const LineVector & lines1, LineDiff & linediff,
+		const IndexVector & pairedTo, const IndexVector & pairedFrom, IndexVector & movedTo,
+		IndexVector & movedFrom)
+{
+	SketchVector sketches;
+	IndexVector deleted;
+	AnchorVector anchors;
+	for (size_t i = 0; i < linediff.size(); ++i) {
+		DiffOp<Line> & op = linediff[i];
+		if (op.op != DiffOp<Line>::del && op.op != DiffOp<Line>::change) {
+			continue;
+		}
+		for (int j = 0; j < op.from.size(); j++) {
+			// Lines of a change which are paired for a word diff are not moves
+			if (op.from[j]->size() < MIN_MOVE_LENGTH || pairedTo[op.from.start + j] >= 0) {
+				continue;
+			}
+			int id = (int)sketches.size();
+			sketches.push_back(LineSketch(*op.from[j]));
+			deleted.push_back(op.from.start + j);
+			for (int k = 0; k < 2 && k < sketches.back().count; k++) {
+				anchors.push_back(Anchor(sketches.back().values[k], id));
+			}
+		}
+	}
+	if (anchors.empty()) {
+		return;
+	}
+	std::sort(anchors.begin(), anchors.end());
+
+	for (size_t i = 0; i < linediff.size(); ++i) {
+		DiffOp<Line> & op = linediff[i];
+		if (op.op != DiffOp<Line>::add && op.op != DiffOp<Line>::change) {
+			continue;
+		}
+		for (int j = 0; j < op.to.size(); j++) {
+			const Line & line = *op.to[j];
+			if (line.size() < MIN_MOVE_LENGTH || pairedFrom[op.to.start + j] >= 0) {
+				continue;
+			}
+			LineSketch sketch(line);
+			int best = -1;
+			double bestSimilarity = 0;
+			for (int k = 0; k < 2 && k < sketch.count; k++) {
+				std::pair<AnchorVector::iterator, AnchorVector::iterator> range =
+					std::equal_range(anchors.begin(), anchors.end(),
+						Anchor(sketch.values[k], 0),
+						[](const Anchor & a, const Anchor & b) { return a.first < b.first; });
+				if (range.second - range.first > MAX_MOVE_CANDIDATES) {
+					continue;
+				}
+				for (AnchorVector::iterator it = range.first; it != range.second; ++it) {
+					int id = it->second;
+					if (movedTo[deleted[id]] >= 0) {
+						continue;
+					}
+					double similarity = sketch.similarity(sketches[id]);
+					if (similarity >= MIN_MOVE_SIMILARITY && similarity > bestSimilarity) {
+						best = id;
+						bestSimilarity = similarity;
+					}
+				}
+			}
+			if (best >= 0 && isMove(lines1[deleted[best]], line)) {
+				movedTo[deleted[best]] = op.to.start + j;
+				movedFrom[op.to.start + j] = deleted[best];
+			}
+		}
+	}
+}
+
+/**
+ * Confirm a move found by sketch, by checking that at least
+ * MIN_MOVE_SIMILARITY of the words of the longer line are unchanged in a
+ * word diff of the two. The diff gives up early on long lines.
+ */
+bool Wikidiff2::isMove(const Line & from, const Line & to)
+{
+	if (from == to) {
+		return true;
+	}
+	WordVector words1, words2;
+	explodeWords(from, words1);
+	explodeWords(to, words2);
+	WordDiff worddiff(words1, words2, MAX_MOVE_DIFF_COMPLEXITY, algorithm, &budget, false,
+		NULL, &wordEngine);
+	size_t copied = 0;
+	for (unsigned i = 0; i < worddiff.size(); ++i) {
+		if (worddiff[i].op == DiffOp<Word>::copy) {
+			copied += worddiff[i].from.size();
+		}
+	}
+	return copied >= MIN_MOVE_SIMILARITY * std::max(words1.size(), words2.size());
+}
+
+void Wikidiff2::startWordDiffs(const LineVector & lines1, const LineVector & lines2,
+		LineDiff & linediff, const IndexVector & pairedTo, WordDiffJobList & jobs)
+{
+	for (size_t i = 0; i < linediff.size(); ++i) {
+		if (linediff[i].op != DiffOp<Line>::change) {
+			continue;
+		}
+		for (int j = 0; j < linediff[i].from.size(); j++) {
+			int from = linediff[i].from.start + j;
+			if (pairedTo[from] >= 0) {
+				jobs.pairs.push_back(std::make_pair(from, pairedTo[from]));
+			}
+		}
+	}
+	int n = (int)jobs.pairs.size();
+	for (int start = 0; start < n; start += WORD_DIFF_BATCH) {
+		int end = std::min(start + (int)WORD_DIFF_BATCH, n);
+		jobs.jobs.emplace_back(start, end);
+	}
+	jobs.next = jobs.jobs.begin();
+
+	// Submit after the list is complete, so that the tasks only ever see
+	// jobs which are not being modified
+	for (std::list<WordDiffJob>::iterator it = jobs.jobs.begin(); it != jobs.jobs.end(); ++it) {
+		WordDiffJob & job = *it;
+		const std::vector<std::pair<int, int> > & pairs = jobs.pairs;
+		pool->submit(job.group, [this, &lines1, &lines2, &pairs, &job] {
+			// Each pool worker keeps one engine for all its tasks. Its memory
+			// comes from malloc(), so it may outlive the request. The request
+			// thread helping out while it waits is not a pool worker, so it
+			// uses a temporary engine rather than keeping one of its own.
+			static thread_local DiffEngine<Word> workerEngine;
+			DiffEngine<Word> localEngine;
+			DiffEngine<Word> & engine = ThreadPool::currentWorker() ? workerEngine : localEngine;
+			String out;
+			for (int j = job.start; j < job.end; j++) {
+				printWordDiff(lines1[pairs[j].first], lines2[pairs[j].second], out, engine);
+				job.ends.push_back(out.size());
+			}
+			job.output.assign(out.data(), out.size());
+		});
+	}
+}
+
+// Append the output of the given word diff, waiting for it if necessary.
+// The word diffs must be finished in order.
+void Wikidiff2::finishWordDiff(int pair, WordDiffJobList & jobs)
+{
+	WordDiffJob & job = *jobs.next;
+	if (pair == job.start) {
+		pool->wait(job.group);
+	}
+	size_t begin = pair == job.start ? 0 : job.ends[pair - job.start - 1];
+	result.append(job.output.data() + begin, job.ends[pair - job.start] - begin);
+	if (pair + 1 == job.end) {
+		std::string().swap(job.output);
+		++jobs.next;
+	}
+}
+
+Wikidiff2::WordDiffJobList::~WordDiffJobList()
+{
+	for (std::list<WordDiffJob>::iterator it = jobs.begin(); it != jobs.end(); ++it) {
+		try {
+			pool->wait(it->group);
+		} catch (...) {
+			// Already failed, the first exception is the one propagating
+		}
 	}
 }
 
@@ -138,37 +495,48 @@ void Wikidiff2::debugPrintWordDiff(WordDiff & worddiff)
 	}
 }
 
-void Wikidiff2::printText(const String & input)
+void Wikidiff2::printText(const Line & input)
+{
+	printText(input.data(), input.size(), result);
+}
+
+void Wikidiff2::printText(const String & input, String & out)
+{
+	printText(input.data(), input.size(), out);
+}
+
+void Wikidiff2::printText(const char * input, size_t length, String & out)
 {
-	size_t start = 0;
-	size_t end = input.find_first_of("<>&");
-	while (end != String::npos) {
-		if (end > start) {
-			result.append(input, start, end - start);
+	const char * p = input;
+	const char * inputEnd = input + length;
+	const char * special = "<>&";
+	const char * end = std::find_first_of(p, inputEnd, special, special + 3);
+	while (end != inputEnd) {
+		if (end > p) {
+			out.append(p, end - p);
 		}
-		switch (input[end]) {
+		switch (*end) {
 			case '<':
-				result.append("&lt;");
+				out.append("&lt;");
 				break;
 			case '>':
-				result.append("&gt;");
+				out.append("&gt;");
 				break;
 			default /*case '&'*/:
-				result.append("&amp;");
+				out.append("&amp;");
 		}
-		start = end + 1;
-		end = input.find_first_of("<>&", start);
+		p = end + 1;
+		end = std::find_first_of(p, inputEnd, special, special + 3);
 	}
 	// Append the rest of the string after the last special character
-	if (start < input.size()) {
-		result.append(input, start, input.size() - start);
+	if (p < inputEnd) {
+		out.append(p, inputEnd - p);
 	}
 }
 
 // Weak UTF-8 decoder
 // Will return garbage on invalid input (overshort sequences, overlong sequences, etc.)
-int Wikidiff2::nextUtf8Char(String::const_iterator & p, String::const_iterator & charStart,
-		String::const_iterator end)
+int Wikidiff2::nextUtf8Char(const char * & p, const char * & charStart, const char * end)
 {
 	int c = 0;
 	unsigned char byte;
@@ -208,130 +576,418 @@ int Wikidiff2::nextUtf8Char(String::const_iterator & p, String::const_iterator &
 	return c;
 }
 
+const unsigned char Wikidiff2::asciiClass[128] = {
+	// Control characters, with tab as a space
+	0, 0, 0, 0, 0, 0, 0, 0, 0, ASCII_SPACE, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	// Space, punctuation and digits
+	ASCII_SPACE, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0,
+	// Upper case and underscore
+	0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 1,
+	// Lower case
+	0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0
+};
+
 // Split a string into words
 //
+// A word is a run of letters, or a single other character. Words are built
+// in one pass, with runs of ASCII letters skipped over in bulk. Runs of Thai
+// characters are split further by libthai's dictionary, and also have a break
+// at each end.
+//
+// A NUL character or an invalid UTF-8 sequence which decodes to zero ends the
+// text, and a space at the very start becomes the suffix of an empty first
+// word, unless another space follows it.
+void Wikidiff2::explodeWords(const Line & text, WordVector &words)
+{
+	const char * p = text.begin();
+	const char * end = text.end();
+	const char * wordStart = p;
+	const char * charStart;
+	bool first = true, lastLetter = false, leadingSpace = false;
+
+	while (p != end) {
+		unsigned char byte = (unsigned char)*p;
+		bool letter, space = false;
+		charStart = p;
+		if (byte < 0x80) {
+			if (!byte) {
+				break;
+			}
+			letter = asciiClass[byte] & ASCII_LETTER;
+			space = asciiClass[byte] & ASCII_SPACE;
+			if (first) {
+				leadingSpace = space;
+			}
+			// No breaks within a run of letters
+			p = letter ? skipAsciiLetters(p + 1, end) : p + 1;
+		} else {
+			int ch = nextUtf8Char(p, charStart, end);
+			if (!ch) {
+				p = charStart;
+				break;
+			}
+			thchar_t thaiChar = th_uni2tis(ch);
+			if (thaiChar >= 0x80 && thaiChar != THCHAR_ERR) {
+				Arena::Scope arenaScope;
+				IntVector breaks;
+				p = segmentThai(charStart, end, breaks);
+				breaks.insert(breaks.begin(), 0);
+				for (size_t i = 0; i < breaks.size(); i++) {
+					const char * brk = charStart + breaks[i];
+					if (!first) {
+						words.push_back(leadingSpace
+							? Word(wordStart, wordStart, brk)
+							: Word(wordStart, brk, brk));
+						leadingSpace = false;
+						wordStart = brk;
+					}
+					first = false;
+				}
+				// Break before whatever follows the run
+				lastLetter = false;
+				continue;
+			}
+			letter = isLetter(ch);
+		}
+
+		// Break before every non-letter, and before a letter which follows
+		// a non-letter
+		if (!first && (!letter || !lastLetter)) {
+			words.push_back(leadingSpace && !space
+				? Word(wordStart, wordStart, charStart)
+				: Word(wordStart, charStart, charStart));
+			leadingSpace = false;
+			wordStart = charStart;
+		}
+		first = false;
+		lastLetter = letter;
+	}
+
+	if (!first) {
+		words.push_back(leadingSpace ? Word(wordStart, wordStart, p) : Word(wordStart, p, p));
+	}
+}
+
+namespace {
+
+// A thread's Thai word breaker. A ThBrk may only be used by one thread at a
+// time, so each thread has its own, which it frees when it exits.
+struct ThaiBreakerHolder {
+	ThaiBreakerHolder() : breaker(NULL), loaded(false) {}
+	~ThaiBreakerHolder() {
+		if (breaker) {
+			th_brk_delete(breaker);
+		}
+	}
+	ThBrk * breaker;
+	// Set once loading has been tried, even if the dictionary was missing
+	bool loaded;
+};
+
+thread_local ThaiBreakerHolder thaiBreaker;
+
+}
+
+void Wikidiff2::initThai()
+{
+	getThaiBreaker();
+}
+
+void Wikidiff2::shutdownThai()
+{
+	if (thaiBreaker.breaker) {
+		th_brk_delete(thaiBreaker.breaker);
+	}
+	thaiBreaker.breaker = NULL;
+	thaiBreaker.loaded = false;
+}
+
+// Get the calling thread's Thai word breaker, loading the dictionary if this
+// thread has not done so yet. Returns NULL if it can't be loaded.
+ThBrk * Wikidiff2::getThaiBreaker()
+{
+	if (!thaiBreaker.loaded) {
+		thaiBreaker.breaker = th_brk_new(NULL);
+		thaiBreaker.loaded = true;
+	}
+	return thaiBreaker.breaker;
+}
+
+// Find the end of the run of Thai characters starting at runStart, and the
+// breaks between the Thai words in it, as byte offsets from runStart.
+//
+// Only the run is converted to TIS-620, the internal character set of
+// libthai, so the cost of segmentation does not depend on how much other text
+// is on the line.
+//
 // TODO: I think the best way to do this would be to use ICU BreakIterator
 // instead of libthai + DIY. Basically you'd run BreakIterators from several
 // different locales (en, th, ja) and merge the results, i.e. if a break occurs
 // in any locale at a given position, split the string. I don't know if the
 // quality of the Thai dictionary in ICU matches the one in libthai, we would
 // have to check this somehow.
-void Wikidiff2::explodeWords(const String & text, WordVector &words)
+const char * Wikidiff2::segmentThai(const char * runStart, const char * end, IntVector & breaks)
 {
-	// Decode the UTF-8 in the string.
-	// * Save the character sizes (in bytes)
-	// * Convert the string to TIS-620, which is the internal character set of libthai.
-	// * Save the character offsets of any break positions (same format as libthai).
-
-	String tisText, charSizes;
-	String::const_iterator suffixEnd, charStart, p;
-	IntSet breaks;
-
-	tisText.reserve(text.size());
-	charSizes.reserve(text.size());
-	wchar_t ch, lastChar;
-	thchar_t thaiChar;
-	bool hasThaiChars = false;
-
-	p = text.begin();
-	ch = nextUtf8Char(p, charStart, text.end());
-	lastChar = 0;
-	int charIndex = 0;
-	while (ch) {
-		thaiChar = th_uni2tis(ch);
-		if (thaiChar >= 0x80 && thaiChar != THCHAR_ERR) {
-			hasThaiChars = true;
+	TempString tisText;
+	IntVector charOffsets;
+	const char * p = runStart;
+	const char * charStart;
+
+	while (p != end) {
+		int ch = nextUtf8Char(p, charStart, end);
+		thchar_t thaiChar = th_uni2tis(ch);
+		if (thaiChar < 0x80 || thaiChar == THCHAR_ERR) {
+			p = charStart;
+			break;
 		}
 		tisText += (char)thaiChar;
-		charSizes += (char)(p - charStart);
+		charOffsets.push_back(charStart - runStart);
+	}
+	if (tisText.size() < 2) {
+		return p;
+	}
 
-		if (isLetter(ch)) {
-			if (lastChar && !isLetter(lastChar)) {
-				breaks.insert(charIndex);
-			}
-		} else {
-			breaks.insert(charIndex);
+	ThBrk * breaker = getThaiBreaker();
+	if (!breaker) {
+		return p;
+	}
+	tisText += '\0';
+	breaks.resize(tisText.size());
+	int numBreaks = th_brk_find_breaks(breaker, (const thchar_t*)(tisText.data()),
+			&breaks[0], breaks.size());
+	// Convert character indexes to byte offsets
+	int numOffsets = 0;
+	for (int i = 0; i < numBreaks; i++) {
+		if (breaks[i] > 0 && breaks[i] < (int)charOffsets.size()) {
+			breaks[numOffsets++] = charOffsets[breaks[i]];
 		}
-		charIndex++;
-		lastChar = ch;
-		ch = nextUtf8Char(p, charStart, text.end());
 	}
+	breaks.resize(numOffsets);
+	return p;
+}
 
-	// If there were any Thai characters in the string, run th_brk on it and add
-	// the resulting break positions
-	if (hasThaiChars) {
-		IntVector thaiBreakPositions;
-		tisText += '\0';
-		thaiBreakPositions.resize(tisText.size());
-		int numBreaks = th_brk((const thchar_t*)(tisText.data()),
-				&thaiBreakPositions[0], thaiBreakPositions.size());
-		thaiBreakPositions.resize(numBreaks);
-		breaks.insert(thaiBreakPositions.begin(), thaiBreakPositions.end());
-	}
+// Split a text into lines, which point into the text rather than copying it
+void Wikidiff2::explodeLines(const char * begin, const char * end, LineVector &lines)
+{
+	const char * ptr = begin;
+	while (ptr != end) {
+		const char * ptr2 = (const char*)memchr(ptr, '\n', end - ptr);
+		if (!ptr2) {
+			ptr2 = end;
+		}
+		lines.push_back(Line(ptr, ptr2 - ptr));
 
-	// Add a fake end-of-string character and have a break on it, so that the
-	// last word gets added without special handling
-	breaks.insert(charSizes.size());
-	charSizes += (char)0;
+		ptr = ptr2;
+		if (ptr != end) {
+			++ptr;
+		}
+	}
+}
 
-	// Now make the word array by traversing the breaks set
-	p = text.begin();
-	IntSet::iterator pBrk = breaks.begin();
-	String::const_iterator wordStart = text.begin();
-	String::const_iterator suffixStart = text.end();
+// Split the part [begin, end) of a text into lines, as explodeLines() does.
+// With setReuseLines(), the lines which the previous call to execute() split
+// from the same text are copied rather than split and hashed again.
+void Wikidiff2::splitText(const char * text, size_t length, size_t begin, size_t end,
+		LineVector & lines)
+{
+	// Both parts start and end on line boundaries, so their overlap does too
+	size_t overlapBegin = std::max(begin, lastText.begin);
+	size_t overlapEnd = std::min(end, lastText.end);
+	if (!reuseLines || text != lastText.text || length != lastText.length
+		|| overlapBegin >= overlapEnd)
+	{
+		explodeLines(text + begin, text + end, lines);
+		return;
+	}
+	explodeLines(text + begin, text + overlapBegin, lines);
+	auto startsBefore = [](const Line & line, const char * p) { return line.start < p; };
+	LineVector::iterator first = std::lower_bound(lastText.lines.begin(),
+		lastText.lines.end(), text + overlapBegin, startsBefore);
+	LineVector::iterator last = std::lower_bound(first, lastText.lines.end(),
+		text + overlapEnd, startsBefore);
+	lines.insert(lines.end(), first, last);
+	explodeLines(text + overlapEnd, text + end, lines);
+}
 
-	// If there's a break at the start of the string, skip it
-	if (pBrk != breaks.end() && *pBrk == 0) {
-		pBrk++;
+// Length of the common prefix of two byte arrays of at least n bytes. Whole
+// blocks are compared with memcmp(), which libc implements with SIMD.
+size_t Wikidiff2::commonPrefixLength(const char * p1, const char * p2, size_t n)
+{
+	size_t i = 0;
+	while (i + COMPARE_BLOCK_SIZE <= n && !memcmp(p1 + i, p2 + i, COMPARE_BLOCK_SIZE)) {
+		i += COMPARE_BLOCK_SIZE;
 	}
+	while (i < n && p1[i] == p2[i]) {
+		i++;
+	}
+	return i;
+}
 
-	for (charIndex = 0; charIndex < charSizes.size(); p += charSizes[charIndex++]) {
-		// Assume all spaces are ASCII
-		if (isSpace(*p)) {
-			suffixStart = p;
-		}
-		if (pBrk != breaks.end() && charIndex == *pBrk) {
-			if (suffixStart == text.end()) {
-				words.push_back(Word(wordStart, p, p));
-			} else {
-				words.push_back(Word(wordStart, suffixStart, p));
-			}
-			pBrk++;
-			suffixStart = text.end();
-			wordStart = p;
-		}
+// Length of the common suffix of two byte arrays ending at end1 and end2,
+// looking back at most n bytes
+size_t Wikidiff2::commonSuffixLength(const char * end1, const char * end2, size_t n)
+{
+	size_t i = 0;
+	while (i + COMPARE_BLOCK_SIZE <= n
+		&& !memcmp(end1 - i - COMPARE_BLOCK_SIZE, end2 - i - COMPARE_BLOCK_SIZE, COMPARE_BLOCK_SIZE))
+	{
+		i += COMPARE_BLOCK_SIZE;
+	}
+	while (i < n && end1[-1 - (ptrdiff_t)i] == end2[-1 - (ptrdiff_t)i]) {
+		i++;
 	}
+	return i;
 }
 
-void Wikidiff2::explodeLines(const String & text, StringVector &lines)
+/**
+ * Find the region of the two texts which needs to be diffed: everything
+ * except the common leading and trailing lines, but keeping numKeepLines of
+ * those on each side. On return, the region is [start, end1) of text1 and
+ * [start, end2) of text2. Both ends fall on line boundaries, so that
+ * splitting the region gives the same lines as splitting the whole text.
+ */
+void Wikidiff2::trimCommonLines(const char * data1, size_t len1, const char * data2, size_t len2,
+		int numKeepLines, size_t & start, size_t & end1, size_t & end2)
 {
-	String::const_iterator ptr = text.begin();
-	while (ptr != text.end()) {
-		String::const_iterator ptr2 = std::find(ptr, text.end(), '\n');
-		lines.push_back(String(ptr, ptr2));
+	size_t minLen = std::min(len1, len2);
 
-		ptr = ptr2;
-		if (ptr != text.end()) {
-			++ptr;
+	// Snap the common prefix back to just after its last newline
+	size_t prefix = commonPrefixLength(data1, data2, minLen);
+	start = prefix;
+	while (start > 0 && data1[start - 1] != '\n') {
+		start--;
+	}
+
+	// The common suffix must not overlap the common prefix. Snap it forward
+	// to a point which is a line start in both texts.
+	size_t suffix = commonSuffixLength(data1 + len1, data2 + len2, minLen - prefix);
+	end1 = len1 - suffix;
+	end2 = len2 - suffix;
+	if ((end1 > 0 && data1[end1 - 1] != '\n') || (end2 > 0 && data2[end2 - 1] != '\n')) {
+		// data1 may be NULL if text1 is empty, so don't pass it to memchr()
+		const char * nl = end1 < len1
+			? (const char*)memchr(data1 + end1, '\n', len1 - end1) : NULL;
+		if (nl) {
+			end2 += nl + 1 - (data1 + end1);
+			end1 = nl + 1 - data1;
+		} else {
+			end1 = len1;
+			end2 = len2;
+		}
+	}
+
+	// Keep some of the common lines on each side
+	for (int i = 0; i < numKeepLines && start > 0; i++) {
+		start--;
+		while (start > 0 && data1[start - 1] != '\n') {
+			start--;
 		}
 	}
+	for (int i = 0; i < numKeepLines && end1 < len1; i++) {
+		const char * nl = (const char*)memchr(data1 + end1, '\n', len1 - end1);
+		size_t next = nl ? nl + 1 - data1 : len1;
+		end2 += next - end1;
+		end1 = next;
+	}
 }
 
 const Wikidiff2::String & Wikidiff2::execute(const String & text1, const String & text2, int numContextLines)
 {
-	// Allocate some result space to avoid excessive copying
-	result.clear();
-	result.reserve(text1.size() + text2.size() + 10000);
+	return execute(text1.data(), text1.size(), text2.data(), text2.size(), numContextLines);
+}
 
-	// Split input strings into lines
-	StringVector lines1;
-	StringVector lines2;
-	explodeLines(text1, lines1);
-	explodeLines(text2, lines2);
+const Wikidiff2::String & Wikidiff2::execute(const char * text1, size_t length1,
+		const char * text2, size_t length2, int numContextLines)
+{
+	budget.used = 0;
+	textBegin1 = text1;
+	textBegin2 = text2;
+
+	// Only split and diff the lines between the common prefix and suffix,
+	// plus enough of those to show as context
+	size_t start, end1, end2;
+	trimCommonLines(text1, length1, text2, length2, numContextLines + TRIM_MARGIN_LINES,
+		start, end1, end2);
+
+	// Allocate some result space to avoid excessive copying. Only the lines
+	// between the common prefix and suffix are shown. With a sink, the
+	// result is only a buffer for one chunk.
+	size_t expectedLength = (end1 - start) + (end2 - start) + 10000;
+	result.clear();
+	if (sink) {
+		sink->reserve(expectedLength);
+		result.reserve(std::min(expectedLength, (size_t)OUTPUT_CHUNK_SIZE + 10000));
+	} else {
+		result.reserve(expectedLength);
+	}
+	printStart();
+	LineVector lines1;
+	LineVector lines2;
+	splitText(text1, length1, start, end1, lines1);
+	explodeLines(text2 + start, text2 + end2, lines2);
+	int lineOffset = (int)std::count(text1, text1 + start, '\n');
 
 	// Do the diff
-	diffLines(lines1, lines2, numContextLines);
+	if (!diffLines(lines1, lines2, numContextLines, lineOffset,
+		start > 0, end1 < length1))
+	{
+		// A change reached the trimmed part, so diff the whole texts
+		lines1.clear();
+		lines2.clear();
+		explodeLines(text1, text1 + length1, lines1);
+		explodeLines(text2, text2 + length2, lines2);
+		budget.used = 0;
+		diffLines(lines1, lines2, numContextLines);
+		start = 0;
+		end2 = length2;
+	}
+	flushOutput(true);
+
+	if (reuseLines) {
+		lastText.text = text2;
+		lastText.length = length2;
+		lastText.begin = start;
+		lastText.end = end2;
+		lastText.lines.swap(lines2);
+	}
 
 	// Return a reference to the result buffer
 	return result;
 }
+
+const Wikidiff2::String & Wikidiff2::execute(DiffSession & session, const char * draft,
+		size_t length, int numContextLines)
+{
+	budget.used = 0;
+	session.update(draft, length, lineEngine, algorithm, &budget);
+	textBegin1 = session.getBaseText();
+	textBegin2 = session.getDraftText();
+
+	// Rebuild the line diff from the session's edit script, over copies of
+	// its lines, which the word diff tasks may read
+	LineVector lines1(session.getBaseLines().begin(), session.getBaseLines().end());
+	LineVector lines2(session.getDraftLines().begin(), session.getDraftLines().end());
+	LineDiff linediff;
+	const DiffSession::EditVector & edits = session.getEdits();
+	for (size_t i = 0; i < edits.size(); i++) {
+		const DiffSession::Edit & edit = edits[i];
+		linediff.add_edit(DiffOp<Line>(edit.op,
+			DiffOp<Line>::Range(lines1.data(), edit.fromStart, edit.fromLength),
+			DiffOp<Line>::Range(lines2.data(), edit.toStart, edit.toLength)));
+	}
+
+	result.clear();
+	if (sink) {
+		result.reserve(OUTPUT_CHUNK_SIZE + 10000);
+	} else {
+		result.reserve(10000);
+	}
+	printStart();
+	printLineDiff(lines1, lines2, linediff, numContextLines, 0);
+	flushOutput(true);
+	return result;
+}
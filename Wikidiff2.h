@@ -11,58 +11,265 @@
 
 #include "DiffEngine.h"
 #include "Word.h"
+#include "Line.h"
+#include "Arena.h"
+#include "OutputSink.h"
+#include "LineSketch.h"
 #include <string>
 #include <vector>
-#include <set>
+#include <list>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// libthai's word breaker, from thai/thbrk.h
+typedef struct _ThBrk ThBrk;
+
+class DiffSession;
 
 class Wikidiff2 {
 	public:
 		typedef std::basic_string<char, std::char_traits<char>, WD2_ALLOCATOR<char> > String;
 		typedef std::vector<String, WD2_ALLOCATOR<String> > StringVector;
 		typedef std::vector<Word, WD2_ALLOCATOR<Word> > WordVector;
-		typedef std::vector<int, WD2_ALLOCATOR<int> > IntVector;
-		typedef std::set<int, std::less<int>, WD2_ALLOCATOR<int> > IntSet;
+		typedef std::vector<Line, WD2_ALLOCATOR<Line> > LineVector;
+		// Temporaries of explodeWords(), allocated from the thread's Arena
+		typedef std::basic_string<char, std::char_traits<char>, ArenaAllocator<char> > TempString;
+		typedef std::vector<int, ArenaAllocator<int> > IntVector;
+		typedef std::vector<int, WD2_ALLOCATOR<int> > IndexVector;
+		typedef std::vector<LineSketch, WD2_ALLOCATOR<LineSketch> > SketchVector;
+		typedef std::pair<uint32_t, int> Anchor;
+		typedef std::vector<Anchor, WD2_ALLOCATOR<Anchor> > AnchorVector;
 
 		typedef Diff<String> StringDiff;
+		typedef Diff<Line> LineDiff;
 		typedef Diff<Word> WordDiff;
 
+		Wikidiff2() : algorithm(DIFF_ALGORITHM_DAIRIKI), approximateThreshold(0), pool(NULL),
+			sink(NULL), detectMoves(false), reuseLines(false), textBegin1(NULL),
+			textBegin2(NULL) {}
+
 		const String & execute(const String & text1, const String & text2, int numContextLines);
 
+		// Diff two texts in the caller's buffers, which are not copied. They
+		// must stay valid and unchanged until execute() returns.
+		const String & execute(const char * text1, size_t length1, const char * text2,
+				size_t length2, int numContextLines);
+
+		// Diff the base text of a session with a new draft, which is copied,
+		// diffing only what changed since the session's last draft
+		const String & execute(DiffSession & session, const char * draft, size_t length,
+				int numContextLines);
+
 		inline const String & getResult() const;
 
+		// Select the algorithm used for both line-level and word-level diffs
+		inline void setAlgorithm(DiffAlgorithm algorithm_);
+
+		// Limit the work done by all the diffs in one call to execute(). Once
+		// the limit is reached, whatever remains is shown as changed lines.
+		// Zero means no limit.
+		inline void setMaxWork(long long maxWork);
+
+		// Use the approximate O(n log n) line diff when the two texts have more
+		// than this many lines in total. Zero means never.
+		inline void setApproximateThreshold(int threshold);
+
+		// Run large line diffs, and the word diffs of changed lines, on the
+		// given thread pool. NULL means serial.
+		inline void setThreadPool(ThreadPool * pool_);
+
+		// Write the output to the given sink while diffing, rather than
+		// collecting all of it for getResult(). execute() then returns an
+		// empty string. NULL means no sink.
+		inline void setOutputSink(OutputSink * sink_);
+
+		// Show paragraphs which were deleted in one place and added, unchanged
+		// or nearly so, in another as moved, linked to each other
+		inline void setDetectMoves(bool detectMoves_);
+
+		// Keep the lines split from the second text after execute(), and
+		// reuse them if the next call's first text is the same buffer, as
+		// when diffing consecutive revisions. A buffer is recognised by its
+		// address and length only, so the caller must keep it valid and
+		// unchanged, or call setReuseLines(false) to forget it.
+		inline void setReuseLines(bool reuseLines_);
+
+		// Load the Thai word break dictionary for the calling thread now,
+		// rather than when it first meets Thai text. This is called at module
+		// startup, so that forked worker processes share the loaded copy.
+		static void initThai();
+		static void shutdownThai();
+
+		// Split a text into words, or into lines, as the diffs do
+		static void explodeWords(const Line & text, WordVector &tokens);
+		static void explodeLines(const char * begin, const char * end, LineVector &lines);
+
+		// Find the lines of two texts which differ, keeping numKeepLines of
+		// the common ones around them
+		static void trimCommonLines(const char * data1, size_t len1, const char * data2,
+				size_t len2, int numKeepLines, size_t & start, size_t & end1, size_t & end2);
+
 	protected:
-		enum { MAX_WORD_LEVEL_DIFF_COMPLEXITY = 40000000 };
+		enum {
+			MAX_WORD_LEVEL_DIFF_COMPLEXITY = 40000000,
+			// Number of changed line pairs word-diffed by each pool task
+			WORD_DIFF_BATCH = 8,
+			// Unchanged lines kept beyond the context lines when trimming the
+			// common prefix and suffix, to give boundary shifts some room
+			TRIM_MARGIN_LINES = 2,
+			// Block size for the byte comparison of the common prefix/suffix
+			COMPARE_BLOCK_SIZE = 256,
+			// With an output sink, the amount of output buffered before it is
+			// written to the sink
+			OUTPUT_CHUNK_SIZE = 65536,
+			// Shortest line which may be shown as moved, in bytes
+			MIN_MOVE_LENGTH = 40,
+			// Word diff complexity limit when confirming a move
+			MAX_MOVE_DIFF_COMPLEXITY = 4000000,
+			// Deleted lines sharing a sketch value with more than this many
+			// others are not compared through that value, since it is too
+			// common to say much
+			MAX_MOVE_CANDIDATES = 32,
+			// Changes with more than this many (old lines + 1) x (new lines + 1)
+			// are paired by position rather than aligned by similarity
+			MAX_PAIRING_CELLS = 1 << 20,
+			// Least similarity of two changed lines, in sixteenths, for them
+			// to count as related when pairing
+			MIN_PAIR_SIMILARITY = 4,
+			// Score of each sixteenth of similarity of a pair. It is more than
+			// the number of pairs in any change which is aligned, so that the
+			// alignment favours similarity over the number of pairs.
+			PAIR_SIMILARITY_WEIGHT = 1024
+		};
+
+		// Least similarity of a moved line to its original, estimated from
+		// the sketches to find candidates, and then from a word diff
+		static const double MIN_MOVE_SIMILARITY;
+
+		// Character classes of ASCII characters, for isLetter() and isSpace()
+		enum { ASCII_LETTER = 1, ASCII_SPACE = 2 };
+		static const unsigned char asciiClass[128];
+
+		/**
+		 * A batch of word diffs running on the thread pool. The output is
+		 * kept in a std::string since it is produced outside the PHP thread.
+		 */
+		struct WordDiffJob {
+			WordDiffJob(int start_, int end_) : start(start_), end(end_) {}
+			// The range of WordDiffJobList::pairs diffed
+			int start, end;
+			ThreadPool::TaskGroup group;
+			std::string output;
+			// The end of each pair's output
+			std::vector<size_t> ends;
+		};
+
+		/**
+		 * The word diff batches of one line diff, in output order. The
+		 * destructor waits for any that are still running, so that an
+		 * exception during rendering does not free them from under the pool.
+		 */
+		struct WordDiffJobList {
+			WordDiffJobList(ThreadPool * pool_) : pool(pool_) {}
+			~WordDiffJobList();
+
+			ThreadPool * pool;
+			// The paired lines of all changes, as indexes of the old and new
+			// lines, in output order
+			std::vector<std::pair<int, int> > pairs;
+			std::list<WordDiffJob> jobs;
+			std::list<WordDiffJob>::iterator next;
+		};
+
+		/**
+		 * The lines split from the part [begin, end) of a text
+		 */
+		struct SplitText {
+			SplitText() : text(NULL), length(0), begin(0), end(0) {}
+			const char * text;
+			size_t length, begin, end;
+			LineVector lines;
+		};
+
 		String result;
+		DiffAlgorithm algorithm;
+		DiffBudget budget;
+		int approximateThreshold;
+		ThreadPool * pool;
+		OutputSink * sink;
+		bool detectMoves;
+		bool reuseLines;
+		// The second text of the last call to execute(), with setReuseLines()
+		SplitText lastText;
+		// The two texts of the current call to execute(), which the lines
+		// point into
+		const char * textBegin1;
+		const char * textBegin2;
+		// Engines reused by the diffs of one call to execute(), so that they
+		// keep their allocations from one diff to the next
+		DiffEngine<Line> lineEngine;
+		DiffEngine<Word> wordEngine;
 
-		virtual void diffLines(const StringVector & lines1, const StringVector & lines2,
-				int numContextLines);
-		virtual void printAdd(const String & line) = 0;
-		virtual void printDelete(const String & line) = 0;
-		virtual void printWordDiff(const String & text1, const String & text2) = 0;
+		virtual bool diffLines(const LineVector & lines1, const LineVector & lines2,
+				int numContextLines, int lineOffset = 0, bool trimmedStart = false,
+				bool trimmedEnd = false);
+		void printLineDiff(const LineVector & lines1, const LineVector & lines2,
+				LineDiff & linediff, int numContextLines, int lineOffset);
+		// Print whatever comes before the diff, which for HTML is nothing
+		virtual void printStart() {}
+		virtual void printAdd(const Line & line) = 0;
+		virtual void printDelete(const Line & line) = 0;
+		virtual void printWordDiff(const Line & text1, const Line & text2, String & out,
+				DiffEngine<Word> & engine) = 0;
 		virtual void printBlockHeader(int leftLine, int rightLine) = 0;
-		virtual void printContext(const String & input) = 0;
+		// Print an unchanged line, given its old and new copies
+		virtual void printContext(const Line & from, const Line & to) = 0;
+		// Print one end of a move: the deleted original if added is false,
+		// otherwise the added copy. leftLine and rightLine are the line
+		// numbers of the two ends, so that each can link to the other.
+		virtual void printMove(const Line & from, const Line & to, bool added, int leftLine,
+				int rightLine) = 0;
 
-		void printText(const String & input);
-		inline bool isLetter(int ch);
-		inline bool isSpace(int ch);
+		inline void flushOutput(bool force);
+		void printText(const Line & input);
+		void printText(const String & input, String & out);
+		void printText(const char * input, size_t length, String & out);
+		static inline bool isLetter(int ch);
+		static inline bool isSpace(int ch);
+		static inline const char * skipAsciiLetters(const char * p, const char * end);
 		void debugPrintWordDiff(WordDiff & worddiff);
 
-		int nextUtf8Char(String::const_iterator & p, String::const_iterator & charStart,
-				String::const_iterator end);
+		void pairChangedLines(LineDiff & linediff, IndexVector & pairedTo,
+				IndexVector & pairedFrom);
+		inline int pairScore(const LineSketch & from, const LineSketch & to);
+
+		void findMoves(const LineVector & lines1, LineDiff & linediff,
+				const IndexVector & pairedTo, const IndexVector & pairedFrom,
+				IndexVector & movedTo, IndexVector & movedFrom);
+		bool isMove(const Line & from, const Line & to);
+
+		void startWordDiffs(const LineVector & lines1, const LineVector & lines2,
+				LineDiff & linediff, const IndexVector & pairedTo, WordDiffJobList & jobs);
+		void finishWordDiff(int pair, WordDiffJobList & jobs);
+
+		static int nextUtf8Char(const char * & p, const char * & charStart, const char * end);
 
-		void explodeWords(const String & text, WordVector &tokens);
-		void explodeLines(const String & text, StringVector &lines);
+		static ThBrk * getThaiBreaker();
+		static const char * segmentThai(const char * runStart, const char * end,
+				IntVector & breaks);
+		void splitText(const char * text, size_t length, size_t begin, size_t end,
+				LineVector & lines);
+
+		static size_t commonPrefixLength(const char * p1, const char * p2, size_t n);
+		static size_t commonSuffixLength(const char * end1, const char * end2, size_t n);
 };
 
 inline bool Wikidiff2::isLetter(int ch)
 {
 	// Standard alphanumeric
-	if ((ch >= '0' && ch <= '9') ||
-	   (ch == '_') ||
-	   (ch >= 'A' && ch <= 'Z') ||
-	   (ch >= 'a' && ch <= 'z'))
-	{
-		return true;
+	if ((unsigned)ch < 0x80) {
+		return asciiClass[ch] & ASCII_LETTER;
 	}
 	// Punctuation and control characters
 	if (ch < 0xc0) return false;
@@ -75,7 +282,48 @@ inline bool Wikidiff2::isLetter(int ch)
 
 inline bool Wikidiff2::isSpace(int ch)
 {
-	return ch == ' ' || ch == '\t';
+	return (unsigned)ch < 0x80 && (asciiClass[ch] & ASCII_SPACE);
+}
+
+// Skip over a run of ASCII letters, returning a pointer to the first byte
+// which is not one
+inline const char * Wikidiff2::skipAsciiLetters(const char * p, const char * end)
+{
+#ifdef __SSE2__
+	// Compare 16 bytes at a time. Bytes of 0x80 and above are negative, so
+	// they fall outside all of the ranges.
+	const __m128i digitLo = _mm_set1_epi8('0' - 1), digitHi = _mm_set1_epi8('9' + 1);
+	const __m128i upperLo = _mm_set1_epi8('A' - 1), upperHi = _mm_set1_epi8('Z' + 1);
+	const __m128i lowerLo = _mm_set1_epi8('a' - 1), lowerHi = _mm_set1_epi8('z' + 1);
+	const __m128i underscore = _mm_set1_epi8('_');
+	while (end - p >= 16) {
+		__m128i c = _mm_loadu_si128((const __m128i*)p);
+		__m128i letter = _mm_or_si128(
+			_mm_or_si128(
+				_mm_and_si128(_mm_cmpgt_epi8(c, digitLo), _mm_cmplt_epi8(c, digitHi)),
+				_mm_and_si128(_mm_cmpgt_epi8(c, upperLo), _mm_cmplt_epi8(c, upperHi))),
+			_mm_or_si128(
+				_mm_and_si128(_mm_cmpgt_epi8(c, lowerLo), _mm_cmplt_epi8(c, lowerHi)),
+				_mm_cmpeq_epi8(c, underscore)));
+		unsigned mask = ~_mm_movemask_epi8(letter) & 0xffff;
+		if (mask) {
+			return p + __builtin_ctz(mask);
+		}
+		p += 16;
+	}
+#endif
+	while (p != end && (unsigned char)*p < 0x80 && (asciiClass[(unsigned char)*p] & ASCII_LETTER)) {
+		p++;
+	}
+	return p;
+}
+
+// Score of pairing two changed lines, for pairChangedLines(): one for the
+// pair, plus a weight for its similarity if they are related at all
+inline int Wikidiff2::pairScore(const LineSketch & from, const LineSketch & to)
+{
+	int similarity = (int)(from.similarity(to) * LineSketch::SIZE + 0.5);
+	return 1 + (similarity >= MIN_PAIR_SIMILARITY ? similarity * PAIR_SIMILARITY_WEIGHT : 0);
 }
 
 inline const Wikidiff2::String & Wikidiff2::getResult() const
@@ -83,4 +331,52 @@ inline const Wikidiff2::String & Wikidiff2::getResult() const
 	return result;
 }
 
+inline void Wikidiff2::setAlgorithm(DiffAlgorithm algorithm_)
+{
+	algorithm = algorithm_;
+}
+
+inline void Wikidiff2::setMaxWork(long long maxWork)
+{
+	budget.limit = maxWork;
+}
+
+inline void Wikidiff2::setApproximateThreshold(int threshold)
+{
+	approximateThreshold = threshold;
+}
+
+inline void Wikidiff2::setThreadPool(ThreadPool * pool_)
+{
+	pool = pool_;
+}
+
+inline void Wikidiff2::setOutputSink(OutputSink * sink_)
+{
+	sink = sink_;
+}
+
+inline void Wikidiff2::setDetectMoves(bool detectMoves_)
+{
+	detectMoves = detectMoves_;
+}
+
+inline void Wikidiff2::setReuseLines(bool reuseLines_)
+{
+	reuseLines = reuseLines_;
+	if (!reuseLines) {
+		lastText = SplitText();
+	}
+}
+
+// Pass the buffered output to the sink, if there is one and either the
+// buffer is full or force is set
+inline void Wikidiff2::flushOutput(bool force)
+{
+	if (sink && (force || result.size() >= OUTPUT_CHUNK_SIZE) && result.size()) {
+		sink->write(result.data(), result.size());
+		result.clear();
+	}
+}
+
 #endif
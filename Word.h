@@ -9,13 +9,13 @@
 // optional suffix (the latter consisting of a single whitespace), where
 // only the bodies are compared on operator==.
 //
-// This class stores iterators pointing to the line string, this is to avoid
-// excessive allocation calls. To avoid invalidation, the source string should
-// not be changed or destroyed.
+// This class stores pointers into the line, this is to avoid excessive
+// allocation calls. To avoid invalidation, the source text should not be
+// changed or destroyed.
 class Word {
 public:
 	typedef std::basic_string<char, std::char_traits<char>, WD2_ALLOCATOR<char> > String;
-	typedef String::const_iterator Iterator;
+	typedef const char * Iterator;
 
 	Iterator bodyStart;
 	Iterator bodyEnd;
@@ -60,5 +60,13 @@ public:
 	}
 };
 
+// Only the body takes part in comparisons, so only the body is hashed
+template<>
+struct DiffHash<Word>
+{
+	uint32_t operator()(const Word & w) const {
+		return diffHashBytes(w.bodyStart, w.bodyEnd);
+	}
+};
 
 #endif
@@ -0,0 +1,95 @@
+#include <string.h>
+#include "WordDiffCache.h"
+
+std::atomic<size_t> WordDiffCache::capacity(0);
+std::atomic<long long> WordDiffCache::hits(0);
+std::atomic<long long> WordDiffCache::misses(0);
+
+WordDiffCache & WordDiffCache::current()
+{
+	static thread_local WordDiffCache cache;
+	return cache;
+}
+
+uint64_t WordDiffCache::makeKey(int format, int algorithm, const Line & text1,
+		const Line & text2)
+{
+	uint64_t key = ((uint64_t)text1.hash << 32) | text2.hash;
+	// Mix in the lengths and options, with an odd multiplier so that no bits
+	// are lost
+	key ^= (uint64_t)text1.size() * 0x9e3779b97f4a7c15ULL;
+	key ^= ((uint64_t)text2.size() << 16) ^ ((uint64_t)format << 8) ^ (uint64_t)algorithm;
+	return key;
+}
+
+size_t WordDiffCache::entrySize(const Entry & entry)
+{
+	return entry.text1.size() + entry.text2.size() + entry.fragment.size() + ENTRY_OVERHEAD;
+}
+
+const std::string * WordDiffCache::lookup(int format, int algorithm, const Line & text1,
+		const Line & text2)
+{
+	if (!enabled()) {
+		evict(0);
+		return NULL;
+	}
+	std::unordered_map<uint64_t, EntryList::iterator>::iterator found =
+		index.find(makeKey(format, algorithm, text1, text2));
+	// The key is only a hash, so check the lines themselves
+	if (found == index.end()
+		|| found->second->text1.size() != text1.size()
+		|| found->second->text2.size() != text2.size()
+		|| memcmp(found->second->text1.data(), text1.data(), text1.size())
+		|| memcmp(found->second->text2.data(), text2.data(), text2.size()))
+	{
+		misses++;
+		return NULL;
+	}
+	hits++;
+	entries.splice(entries.begin(), entries, found->second);
+	return &entries.front().fragment;
+}
+
+void WordDiffCache::store(int format, int algorithm, const Line & text1, const Line & text2,
+		const char * fragment, size_t length)
+{
+	size_t limit = capacity;
+	size_t size = text1.size() + text2.size() + length + ENTRY_OVERHEAD;
+	// Don't let one huge pair of lines flush everything else
+	if (size > limit / 4) {
+		return;
+	}
+
+	uint64_t key = makeKey(format, algorithm, text1, text2);
+	std::unordered_map<uint64_t, EntryList::iterator>::iterator found = index.find(key);
+	if (found != index.end()) {
+		used -= entrySize(*found->second);
+		entries.erase(found->second);
+		index.erase(found);
+	}
+	evict(limit - size);
+
+	entries.push_front(Entry());
+	Entry & entry = entries.front();
+	entry.key = key;
+	entry.text1.assign(text1.data(), text1.size());
+	entry.text2.assign(text2.data(), text2.size());
+	entry.fragment.assign(fragment, length);
+	index[key] = entries.begin();
+	used += size;
+}
+
+/**
+ * Drop the least recently used entries until no more than limit bytes are
+ * in use.
+ */
+void WordDiffCache::evict(size_t limit)
+{
+	while (used > limit && !entries.empty()) {
+		Entry & entry = entries.back();
+		used -= entrySize(entry);
+		index.erase(entry.key);
+		entries.pop_back();
+	}
+}
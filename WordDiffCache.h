@@ -0,0 +1,79 @@
+#ifndef WORDDIFFCACHE_H
+#define WORDDIFFCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include "Wikidiff2.h"
+
+/**
+ * A bounded LRU cache of rendered word diffs, keyed by the contents of the
+ * pair of lines. Table rows and template parameters often produce the same
+ * pair of changed lines many times in one diff, and again in the diffs of
+ * neighbouring revisions.
+ *
+ * Each thread has its own cache, so no locking is needed, and it is kept
+ * from one request to the next. Like the Arena, it allocates with malloc()
+ * rather than from the PHP request pool.
+ *
+ * There is one capacity setting, which limits each thread's cache
+ * separately. It is zero, i.e. disabled, until setCapacity() is called. The
+ * hit and miss counts are totals for the process.
+ */
+class WordDiffCache {
+	public:
+		// Output formats, which are cached separately
+		enum Format { FORMAT_TABLE = 0, FORMAT_INLINE = 1, FORMAT_EDIT_SCRIPT = 2 };
+
+		WordDiffCache() : used(0) {}
+
+		/** The calling thread's cache */
+		static WordDiffCache & current();
+
+		/** Set the size limit of each thread's cache, in bytes */
+		static void setCapacity(size_t capacity_) { capacity = capacity_; }
+		static size_t getCapacity() { return capacity; }
+		static bool enabled() { return capacity > 0; }
+
+		static long long getHits() { return hits; }
+		static long long getMisses() { return misses; }
+
+		/**
+		 * Find the rendered word diff of the given lines. The returned string
+		 * stays valid until the next call to store(). Returns NULL on a miss.
+		 */
+		const std::string * lookup(int format, int algorithm, const Line & text1,
+				const Line & text2);
+
+		void store(int format, int algorithm, const Line & text1, const Line & text2,
+				const char * fragment, size_t length);
+
+	protected:
+		struct Entry {
+			uint64_t key;
+			std::string text1, text2, fragment;
+		};
+		typedef std::list<Entry> EntryList;
+
+		// Estimated allocation overhead of an entry, beyond the strings
+		enum { ENTRY_OVERHEAD = 128 };
+
+		static uint64_t makeKey(int format, int algorithm, const Line & text1,
+				const Line & text2);
+		static size_t entrySize(const Entry & entry);
+		void evict(size_t limit);
+
+		// Most recently used first
+		EntryList entries;
+		std::unordered_map<uint64_t, EntryList::iterator> index;
+		size_t used;
+
+		static std::atomic<size_t> capacity;
+		static std::atomic<long long> hits;
+		static std::atomic<long long> misses;
+};
+
+#endif
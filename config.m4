@@ -11,6 +11,7 @@ if test "$PHP_WIKIDIFF2" != "no"; then
   PHP_REQUIRE_CXX
   AC_LANG_CPLUSPLUS
   PHP_ADD_LIBRARY(stdc++,,WIKIDIFF2_SHARED_LIBADD)
+  PHP_ADD_LIBRARY(pthread,,WIKIDIFF2_SHARED_LIBADD)
 
   if test -z "$PKG_CONFIG"
   then
@@ -25,6 +26,10 @@ if test "$PHP_WIKIDIFF2" != "no"; then
   then
 	AC_MSG_ERROR(['libthai' not known to pkg-config])
   fi
+  if ! $PKG_CONFIG --atleast-version=0.1.25 libthai
+  then
+	AC_MSG_ERROR(['libthai' 0.1.25 or later is required])
+  fi
 
   PHP_EVAL_INCLINE(`$PKG_CONFIG --cflags-only-I libthai`)
   PHP_EVAL_LIBLINE(`$PKG_CONFIG --libs libthai`, WIKIDIFF2_SHARED_LIBADD)
@@ -36,6 +41,6 @@ if test "$PHP_WIKIDIFF2" != "no"; then
 
   PHP_SUBST(WIKIDIFF2_SHARED_LIBADD)
   AC_DEFINE(HAVE_WIKIDIFF2, 1, [ ])
-  export CXXFLAGS="-Wno-write-strings $CXXFLAGS"
-  PHP_NEW_EXTENSION(wikidiff2, php_wikidiff2.cpp Wikidiff2.cpp TableDiff.cpp InlineDiff.cpp, $ext_shared)
+  export CXXFLAGS="-Wno-write-strings -std=c++11 -pthread $CXXFLAGS"
+  PHP_NEW_EXTENSION(wikidiff2, php_wikidiff2.cpp Wikidiff2.cpp TableDiff.cpp InlineDiff.cpp ThreadPool.cpp Arena.cpp WordDiffCache.cpp ResultCache.cpp BatchDiff.cpp Blame.cpp DiffSession.cpp EditScriptDiff.cpp, $ext_shared)
 fi
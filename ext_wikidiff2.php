@@ -1,6 +1,31 @@
 <?hh
 <<__Native>>
-function wikidiff2_do_diff(string $text1, string $text2, int $numContextLines): string;
+function wikidiff2_do_diff(string $text1, string $text2, int $numContextLines,
+	int $algorithm = 0, int $maxWork = 0): string;
 
 <<__Native>>
-function wikidiff2_inline_diff(string $text1, string $text2, int $numContextLines): string;
+function wikidiff2_inline_diff(string $text1, string $text2, int $numContextLines,
+	int $algorithm = 0, int $maxWork = 0): string;
+
+<<__Native>>
+function wikidiff2_word_cache_stats(): array;
+
+<<__Native>>
+function wikidiff2_result_cache_stats(): array;
+
+<<__Native>>
+function wikidiff2_batch_diff(array $pairs, array $options = []): array;
+
+<<__Native>>
+function wikidiff2_blame(array $revisions, array $options = []): array;
+
+<<__Native>>
+function wikidiff2_session_diff(string $key, string $base, string $draft,
+	array $options = []): string;
+
+<<__Native>>
+function wikidiff2_edit_script(string $text1, string $text2, int $numContextLines,
+	int $algorithm = 0, int $maxWork = 0): string;
+
+<<__Native>>
+function wikidiff2_decode_edit_script(string $script): mixed;
@@ -4,15 +4,74 @@
 #include "hphp/runtime/ext/extension.h"
 #include "hphp/util/compatibility.h"
 #include "hphp/util/alloc.h"
+#include "hphp/runtime/base/string-buffer.h"
 #include "Wikidiff2.h"
 #include "TableDiff.h"
 #include "InlineDiff.h"
+#include "EditScriptDiff.h"
+#include "WordDiffCache.h"
+#include "ResultCache.h"
+#include "BatchDiff.h"
+#include "Blame.h"
+#include "DiffSession.h"
 
 #include <string>
 
 namespace HPHP {
 
-/* {{{ proto string wikidiff2_do_diff(string text1, string text2, int numContextLines)
+const StaticString
+	s_WIKIDIFF2_ALGORITHM_DAIRIKI("WIKIDIFF2_ALGORITHM_DAIRIKI"),
+	s_WIKIDIFF2_ALGORITHM_MYERS("WIKIDIFF2_ALGORITHM_MYERS"),
+	s_hits("hits"),
+	s_misses("misses"),
+	s_format("format"),
+	s_numContextLines("numContextLines"),
+	s_algorithm("algorithm"),
+	s_maxWork("maxWork"),
+	s_inline("inline"),
+	s_table("table"),
+	s_level("level"),
+	s_line("line"),
+	s_word("word"),
+	s_offsets("offsets"),
+	s_origins("origins"),
+	s_editscript("editscript"),
+	s_op("op"),
+	s_from("from"),
+	s_fromLength("fromLength"),
+	s_to("to"),
+	s_toLength("toLength"),
+	s_leftLine("leftLine"),
+	s_rightLine("rightLine"),
+	s_words("words");
+
+// wikidiff2.approximate_threshold. This is only read at startup, since a
+// per-request setting would need request-local storage.
+static int64_t s_approximate_threshold = 0;
+// wikidiff2.detect_moves, likewise
+static int64_t s_detect_moves = 0;
+// wikidiff2.threads
+static int64_t s_threads = 0;
+// wikidiff2.word_cache_size
+static int64_t s_word_cache_size = 1048576;
+// wikidiff2.result_cache_size
+static int64_t s_result_cache_size = 0;
+// wikidiff2.session_cache_size
+static int64_t s_session_cache_size = 4194304;
+
+/**
+ * Output sink which appends to a StringBuffer, from which the return value
+ * is detached without another copy
+ */
+class StringBufferOutputSink : public OutputSink {
+	public:
+		void write(const char * data, size_t length) { buffer.append(data, length); }
+		// Grow the buffer once up front, without appending anything
+		void reserve(size_t length) { buffer.appendCursor(length); }
+		StringBuffer buffer;
+};
+
+/* {{{ proto string wikidiff2_do_diff(string text1, string text2, int numContextLines [, int algorithm [, int maxWork]])
  *
  * Warning: the input text must be valid UTF-8! Do not pass user input directly
  * to this function.
@@ -20,14 +79,42 @@ namespace HPHP {
 static String HHVM_FUNCTION(wikidiff2_do_diff,
 	const String& text1,
 	const String& text2,
-	int64_t numContextLines)
+	int64_t numContextLines,
+	int64_t algorithm,
+	int64_t maxWork)
 {
     String result;
+	if (algorithm != DIFF_ALGORITHM_DAIRIKI && algorithm != DIFF_ALGORITHM_MYERS) {
+		raise_warning("Invalid algorithm passed to wikidiff2_do_diff().");
+		return result;
+	}
 	try {
 		TableDiff wikidiff2;
-		Wikidiff2::String text1String(text1.c_str());
-		Wikidiff2::String text2String(text2.c_str());
-		result = wikidiff2.execute(text1String, text2String, numContextLines);
+		StringBufferOutputSink sink;
+		ResultCache * cache = ResultCache::getShared();
+		ResultCache::Key key;
+		if (cache) {
+			key = cache->makeKey(text1.data(), text1.size(), text2.data(), text2.size(),
+				ResultCache::FORMAT_TABLE, numContextLines, algorithm, maxWork,
+				s_approximate_threshold, s_detect_moves);
+			if (cache->lookup(key, sink)) {
+				return sink.buffer.detach();
+			}
+		}
+		wikidiff2.setOutputSink(&sink);
+		wikidiff2.setAlgorithm((DiffAlgorithm)algorithm);
+		wikidiff2.setMaxWork(maxWork);
+		wikidiff2.setApproximateThreshold(s_approximate_threshold);
+		wikidiff2.setDetectMoves(s_detect_moves);
+		if (s_threads > 0) {
+			wikidiff2.setThreadPool(&ThreadPool::getShared(s_threads));
+		}
+		wikidiff2.execute(text1.data(), text1.size(), text2.data(), text2.size(),
+			numContextLines);
+		if (cache) {
+			cache->store(key, sink.buffer.data(), sink.buffer.size());
+		}
+		result = sink.buffer.detach();
 	} catch (OutOfMemoryException &e) {
 		raise_error("Out of memory in wikidiff2_do_diff().");
 	} catch (...) {
@@ -36,7 +123,7 @@ static String HHVM_FUNCTION(wikidiff2_do_diff,
 	return result;
 }
 
-/* {{{ proto string wikidiff2_inline_diff(string text1, string text2, int numContextLines)
+/* {{{ proto string wikidiff2_inline_diff(string text1, string text2, int numContextLines [, int algorithm [, int maxWork]])
  *
  * Warning: the input text must be valid UTF-8! Do not pass user input directly
  * to this function.
@@ -44,14 +131,42 @@ static String HHVM_FUNCTION(wikidiff2_do_diff,
 static String HHVM_FUNCTION(wikidiff2_inline_diff,
 	const String& text1,
 	const String& text2,
-	int64_t numContextLines)
+	int64_t numContextLines,
+	int64_t algorithm,
+	int64_t maxWork)
 {
     String result;
+	if (algorithm != DIFF_ALGORITHM_DAIRIKI && algorithm != DIFF_ALGORITHM_MYERS) {
+		raise_warning("Invalid algorithm passed to wikidiff2_inline_diff().");
+		return result;
+	}
 	try {
 		InlineDiff wikidiff2;
-		Wikidiff2::String text1String(text1.c_str());
-		Wikidiff2::String text2String(text2.c_str());
-		result = wikidiff2.execute(text1String, text2String, numContextLines);
+		StringBufferOutputSink sink;
+		ResultCache * cache = ResultCache::getShared();
+		ResultCache::Key key;
+		if (cache) {
+			key = cache->makeKey(text1.data(), text1.size(), text2.data(), text2.size(),
+				ResultCache::FORMAT_INLINE, numContextLines, algorithm, maxWork,
+				s_approximate_threshold, s_detect_moves);
+			if (cache->lookup(key, sink)) {
+				return sink.buffer.detach();
+			}
+		}
+		wikidiff2.setOutputSink(&sink);
+		wikidiff2.setAlgorithm((DiffAlgorithm)algorithm);
+		wikidiff2.setMaxWork(maxWork);
+		wikidiff2.setApproximateThreshold(s_approximate_threshold);
+		wikidiff2.setDetectMoves(s_detect_moves);
+		if (s_threads > 0) {
+			wikidiff2.setThreadPool(&ThreadPool::getShared(s_threads));
+		}
+		wikidiff2.execute(text1.data(), text1.size(), text2.data(), text2.size(),
+			numContextLines);
+		if (cache) {
+			cache->store(key, sink.buffer.data(), sink.buffer.size());
+		}
+		result = sink.buffer.detach();
 	} catch (OutOfMemoryException &e) {
 		raise_error("Out of memory in wikidiff2_do_diff().");
 	} catch (...) {
@@ -60,13 +175,428 @@ static String HHVM_FUNCTION(wikidiff2_inline_diff,
 	return result;
 }
 
+/* {{{ proto string wikidiff2_edit_script(string text1, string text2, int numContextLines [, int algorithm [, int maxWork]])
+ *
+ * Get the diff as a compact binary edit script rather than as HTML. It can be
+ * read with wikidiff2_decode_edit_script().
+ *
+ * Warning: the input text must be valid UTF-8! Do not pass user input directly
+ * to this function.
+ */
+static String HHVM_FUNCTION(wikidiff2_edit_script,
+	const String& text1,
+	const String& text2,
+	int64_t numContextLines,
+	int64_t algorithm,
+	int64_t maxWork)
+{
+    String result;
+	if (algorithm != DIFF_ALGORITHM_DAIRIKI && algorithm != DIFF_ALGORITHM_MYERS) {
+		raise_warning("Invalid algorithm passed to wikidiff2_edit_script().");
+		return result;
+	}
+	try {
+		EditScriptDiff wikidiff2;
+		StringBufferOutputSink sink;
+		ResultCache * cache = ResultCache::getShared();
+		ResultCache::Key key;
+		if (cache) {
+			key = cache->makeKey(text1.data(), text1.size(), text2.data(), text2.size(),
+				ResultCache::FORMAT_EDIT_SCRIPT, numContextLines, algorithm, maxWork,
+				s_approximate_threshold, s_detect_moves);
+			if (cache->lookup(key, sink)) {
+				return sink.buffer.detach();
+			}
+		}
+		wikidiff2.setOutputSink(&sink);
+		wikidiff2.setAlgorithm((DiffAlgorithm)algorithm);
+		wikidiff2.setMaxWork(maxWork);
+		wikidiff2.setApproximateThreshold(s_approximate_threshold);
+		wikidiff2.setDetectMoves(s_detect_moves);
+		if (s_threads > 0) {
+			wikidiff2.setThreadPool(&ThreadPool::getShared(s_threads));
+		}
+		wikidiff2.execute(text1.data(), text1.size(), text2.data(), text2.size(),
+			numContextLines);
+		if (cache) {
+			cache->store(key, sink.buffer.data(), sink.buffer.size());
+		}
+		result = sink.buffer.detach();
+	} catch (OutOfMemoryException &e) {
+		raise_error("Out of memory in wikidiff2_edit_script().");
+	} catch (...) {
+		raise_error("Unknown exception in wikidiff2_edit_script().");
+	}
+	return result;
+}
+
+/* {{{ proto array wikidiff2_word_cache_stats()
+ *
+ * Get the number of word diffs found in and missing from the word diff
+ * cache, since the process started.
+ */
+static Array HHVM_FUNCTION(wikidiff2_word_cache_stats)
+{
+	return make_map_array(
+		s_hits, WordDiffCache::getHits(),
+		s_misses, WordDiffCache::getMisses());
+}
+
+/* {{{ proto array wikidiff2_result_cache_stats()
+ *
+ * Get the number of diffs found in and missing from the shared result
+ * cache, since the process started.
+ */
+static Array HHVM_FUNCTION(wikidiff2_result_cache_stats)
+{
+	return make_map_array(
+		s_hits, ResultCache::getHits(),
+		s_misses, ResultCache::getMisses());
+}
+
+/* {{{ proto array wikidiff2_batch_diff(array pairs [, array options])
+ *
+ * Diff many pairs of texts in one call. Each element of pairs is an array of
+ * the two texts, and the diffs are returned in the same order. The options
+ * are format ("table", "inline" or "editscript"), numContextLines, algorithm
+ * and maxWork.
+ *
+ * Warning: the input text must be valid UTF-8! Do not pass user input directly
+ * to this function.
+ */
+static Array HHVM_FUNCTION(wikidiff2_batch_diff,
+	const Array& pairs,
+	const Array& options)
+{
+	Array result = Array::Create();
+	BatchDiff::Format format = BatchDiff::FORMAT_TABLE;
+	int64_t numContextLines = 2;
+	int64_t algorithm = DIFF_ALGORITHM_DAIRIKI;
+	int64_t maxWork = 0;
+	if (options.exists(s_format)) {
+		String formatName = options[s_format].toString();
+		if (formatName == s_inline) {
+			format = BatchDiff::FORMAT_INLINE;
+		} else if (formatName == s_editscript) {
+			format = BatchDiff::FORMAT_EDIT_SCRIPT;
+		} else if (formatName != s_table) {
+			raise_warning("Invalid format passed to wikidiff2_batch_diff().");
+			return result;
+		}
+	}
+	if (options.exists(s_numContextLines)) {
+		numContextLines = options[s_numContextLines].toInt64();
+	}
+	if (options.exists(s_algorithm)) {
+		algorithm = options[s_algorithm].toInt64();
+	}
+	if (options.exists(s_maxWork)) {
+		maxWork = options[s_maxWork].toInt64();
+	}
+	if (algorithm != DIFF_ALGORITHM_DAIRIKI && algorithm != DIFF_ALGORITHM_MYERS) {
+		raise_warning("Invalid algorithm passed to wikidiff2_batch_diff().");
+		return result;
+	}
+	try {
+		// Keep a reference to each text, so that its buffer stays valid
+		std::vector<String> texts;
+		BatchDiff::PairVector batchPairs;
+		texts.reserve(pairs.size() * 2);
+		batchPairs.reserve(pairs.size());
+		for (ArrayIter it(pairs); it; ++it) {
+			Variant pair = it.second();
+			if (!pair.isArray() || !pair.toArray().exists(0) || !pair.toArray().exists(1)) {
+				raise_warning("Invalid pair passed to wikidiff2_batch_diff().");
+				return result;
+			}
+			texts.push_back(pair.toArray()[0].toString());
+			texts.push_back(pair.toArray()[1].toString());
+			const String & text1 = texts[texts.size() - 2];
+			const String & text2 = texts[texts.size() - 1];
+			batchPairs.push_back(BatchDiff::Pair(text1.data(), text1.size(),
+				text2.data(), text2.size()));
+		}
+
+		BatchDiff batch(format, numContextLines);
+		batch.setAlgorithm((DiffAlgorithm)algorithm);
+		batch.setMaxWork(maxWork);
+		batch.setApproximateThreshold(s_approximate_threshold);
+		batch.setDetectMoves(s_detect_moves);
+		batch.setResultCache(ResultCache::getShared());
+		if (s_threads > 0) {
+			batch.setThreadPool(&ThreadPool::getShared(s_threads));
+		}
+		batch.execute(batchPairs);
+
+		for (size_t i = 0; i < batchPairs.size(); i++) {
+			result.append(String(batchPairs[i].result.data(), batchPairs[i].result.size(),
+				CopyString));
+		}
+	} catch (OutOfMemoryException &e) {
+		raise_error("Out of memory in wikidiff2_batch_diff().");
+	} catch (...) {
+		raise_error("Unknown exception in wikidiff2_batch_diff().");
+	}
+	return result;
+}
+
+/* {{{ proto array wikidiff2_blame(array revisions [, array options])
+ *
+ * Find the revision which added each line or word of a page, given its
+ * revisions oldest first. Returns the byte offsets of the lines or words of
+ * the last revision as "offsets", and the index of the revision which added
+ * each as "origins". The options are level ("line" or "word") and algorithm.
+ *
+ * Warning: the input text must be valid UTF-8! Do not pass user input directly
+ * to this function.
+ */
+static Array HHVM_FUNCTION(wikidiff2_blame,
+	const Array& revisions,
+	const Array& options)
+{
+	Array result = Array::Create();
+	Blame::Level level = Blame::LEVEL_LINE;
+	int64_t algorithm = DIFF_ALGORITHM_DAIRIKI;
+	if (options.exists(s_level)) {
+		String levelName = options[s_level].toString();
+		if (levelName == s_word) {
+			level = Blame::LEVEL_WORD;
+		} else if (levelName != s_line) {
+			raise_warning("Invalid level passed to wikidiff2_blame().");
+			return result;
+		}
+	}
+	if (options.exists(s_algorithm)) {
+		algorithm = options[s_algorithm].toInt64();
+	}
+	if (algorithm != DIFF_ALGORITHM_DAIRIKI && algorithm != DIFF_ALGORITHM_MYERS) {
+		raise_warning("Invalid algorithm passed to wikidiff2_blame().");
+		return result;
+	}
+	try {
+		Blame blame(level);
+		blame.setAlgorithm((DiffAlgorithm)algorithm);
+		// The previous revision must stay valid while the next is added
+		String previous, current;
+		for (ArrayIter it(revisions); it; ++it) {
+			if (!it.second().isString()) {
+				raise_warning("Invalid revision passed to wikidiff2_blame().");
+				return result;
+			}
+			previous = current;
+			current = it.second().toString();
+			blame.addRevision(current.data(), current.size());
+		}
+
+		Blame::IndexVector offsets;
+		blame.getOffsets(offsets);
+		const Blame::IndexVector & origins = blame.getOrigins();
+		Array offsetArray = Array::Create();
+		Array originArray = Array::Create();
+		for (size_t i = 0; i < offsets.size(); i++) {
+			offsetArray.append((int64_t)offsets[i]);
+			originArray.append((int64_t)origins[i]);
+		}
+		result.set(s_offsets, offsetArray);
+		result.set(s_origins, originArray);
+	} catch (OutOfMemoryException &e) {
+		raise_error("Out of memory in wikidiff2_blame().");
+	} catch (...) {
+		raise_error("Unknown exception in wikidiff2_blame().");
+	}
+	return result;
+}
+
+/* {{{ proto string wikidiff2_session_diff(string key, string base, string draft [, array options])
+ *
+ * Diff a base text with a draft, remembering both under the given key, so
+ * that the next call with the same key and base text only diffs again what
+ * changed in the draft. The options are format ("table", "inline" or
+ * "editscript"), numContextLines, algorithm and maxWork.
+ *
+ * Warning: the input text must be valid UTF-8! Do not pass user input directly
+ * to this function.
+ */
+static String HHVM_FUNCTION(wikidiff2_session_diff,
+	const String& key,
+	const String& base,
+	const String& draft,
+	const Array& options)
+{
+	String result;
+	int format = ResultCache::FORMAT_TABLE;
+	int64_t numContextLines = 2;
+	int64_t algorithm = DIFF_ALGORITHM_DAIRIKI;
+	int64_t maxWork = 0;
+	if (options.exists(s_format)) {
+		String formatName = options[s_format].toString();
+		if (formatName == s_inline) {
+			format = ResultCache::FORMAT_INLINE;
+		} else if (formatName == s_editscript) {
+			format = ResultCache::FORMAT_EDIT_SCRIPT;
+		} else if (formatName != s_table) {
+			raise_warning("Invalid format passed to wikidiff2_session_diff().");
+			return result;
+		}
+	}
+	if (options.exists(s_numContextLines)) {
+		numContextLines = options[s_numContextLines].toInt64();
+	}
+	if (options.exists(s_algorithm)) {
+		algorithm = options[s_algorithm].toInt64();
+	}
+	if (options.exists(s_maxWork)) {
+		maxWork = options[s_maxWork].toInt64();
+	}
+	if (algorithm != DIFF_ALGORITHM_DAIRIKI && algorithm != DIFF_ALGORITHM_MYERS) {
+		raise_warning("Invalid algorithm passed to wikidiff2_session_diff().");
+		return result;
+	}
+	try {
+		TableDiff tableDiff;
+		InlineDiff inlineDiff;
+		EditScriptDiff editScriptDiff;
+		Wikidiff2 & wikidiff2 = format == ResultCache::FORMAT_INLINE ? (Wikidiff2&)inlineDiff
+			: format == ResultCache::FORMAT_EDIT_SCRIPT ? (Wikidiff2&)editScriptDiff
+			: (Wikidiff2&)tableDiff;
+		StringBufferOutputSink sink;
+		std::shared_ptr<DiffSession> session = DiffSession::open(
+			std::string(key.data(), key.size()), base.data(), base.size());
+		wikidiff2.setOutputSink(&sink);
+		wikidiff2.setAlgorithm((DiffAlgorithm)algorithm);
+		wikidiff2.setMaxWork(maxWork);
+		wikidiff2.setDetectMoves(s_detect_moves);
+		if (s_threads > 0) {
+			wikidiff2.setThreadPool(&ThreadPool::getShared(s_threads));
+		}
+		wikidiff2.execute(*session, draft.data(), draft.size(), numContextLines);
+		result = sink.buffer.detach();
+	} catch (OutOfMemoryException &e) {
+		raise_error("Out of memory in wikidiff2_session_diff().");
+	} catch (...) {
+		raise_error("Unknown exception in wikidiff2_session_diff().");
+	}
+	return result;
+}
+
+static const char * const s_record_names[] = {
+	NULL, "block", "context", "delete", "add", "change", "move-delete", "move-add"
+};
+static const char * const s_word_op_names[] = { "copy", "delete", "add", "change" };
+
+/**
+ * Fill an array with the op name and the byte ranges of a decoded edit
+ * script record or word op, leaving out a side it doesn't have
+ */
+static void addEditRanges(Array & array, const char * op, size_t from, size_t fromLength,
+		size_t to, size_t toLength, bool hasFrom, bool hasTo)
+{
+	array.set(s_op, String(op, CopyString));
+	if (hasFrom) {
+		array.set(s_from, (int64_t)from);
+		array.set(s_fromLength, (int64_t)fromLength);
+	}
+	if (hasTo) {
+		array.set(s_to, (int64_t)to);
+		array.set(s_toLength, (int64_t)toLength);
+	}
+}
+
+/* {{{ proto array wikidiff2_decode_edit_script(string script)
+ *
+ * Decode the output of wikidiff2_edit_script() into an array of records,
+ * each with an "op" and either the line numbers "leftLine" and "rightLine"
+ * or byte ranges "from", "fromLength", "to" and "toLength", and for changes
+ * and moves, the word ops as "words". Returns false if the script is invalid.
+ */
+static Variant HHVM_FUNCTION(wikidiff2_decode_edit_script,
+	const String& script)
+{
+	Array result = Array::Create();
+	try {
+		EditScriptDiff::RecordVector records;
+		EditScriptDiff::WordRecordVector words;
+		if (!EditScriptDiff::decode(script.data(), script.size(), records, words)) {
+			raise_warning("Invalid script passed to wikidiff2_decode_edit_script().");
+			return false;
+		}
+		for (size_t i = 0; i < records.size(); i++) {
+			const EditScriptDiff::Record & record = records[i];
+			Array recordArray = Array::Create();
+			if (record.type == EditScriptDiff::RECORD_BLOCK) {
+				recordArray.set(s_op, String(s_record_names[record.type], CopyString));
+				recordArray.set(s_leftLine, (int64_t)record.from);
+				recordArray.set(s_rightLine, (int64_t)record.to);
+			} else {
+				addEditRanges(recordArray, s_record_names[record.type], record.from,
+					record.fromLength, record.to, record.toLength,
+					record.type != EditScriptDiff::RECORD_ADD,
+					record.type != EditScriptDiff::RECORD_DELETE);
+			}
+			if (record.type >= EditScriptDiff::RECORD_CHANGE) {
+				Array wordArray = Array::Create();
+				for (size_t j = record.firstWord; j < record.firstWord + record.numWords; j++) {
+					const EditScriptDiff::WordRecord & word = words[j];
+					Array opArray = Array::Create();
+					addEditRanges(opArray, s_word_op_names[word.op], word.from, word.fromLength,
+						word.to, word.toLength, word.op != DiffOp<Word>::add,
+						word.op != DiffOp<Word>::del);
+					wordArray.append(opArray);
+				}
+				recordArray.set(s_words, wordArray);
+			}
+			result.append(recordArray);
+		}
+	} catch (OutOfMemoryException &e) {
+		raise_error("Out of memory in wikidiff2_decode_edit_script().");
+	} catch (...) {
+		raise_error("Unknown exception in wikidiff2_decode_edit_script().");
+	}
+	return result;
+}
+
 static class Wikidiff2Extension : public Extension {
 	public:
 		Wikidiff2Extension() : Extension("wikidiff2") {}
 		virtual void moduleInit() {
+			Native::registerConstant<KindOfInt64>(
+				s_WIKIDIFF2_ALGORITHM_DAIRIKI.get(), DIFF_ALGORITHM_DAIRIKI);
+			Native::registerConstant<KindOfInt64>(
+				s_WIKIDIFF2_ALGORITHM_MYERS.get(), DIFF_ALGORITHM_MYERS);
+			IniSetting::Bind(this, IniSetting::PHP_INI_SYSTEM,
+				"wikidiff2.approximate_threshold", "0", &s_approximate_threshold);
+			IniSetting::Bind(this, IniSetting::PHP_INI_SYSTEM,
+				"wikidiff2.detect_moves", "0", &s_detect_moves);
+			IniSetting::Bind(this, IniSetting::PHP_INI_SYSTEM,
+				"wikidiff2.threads", "0", &s_threads);
+			IniSetting::Bind(this, IniSetting::PHP_INI_SYSTEM,
+				"wikidiff2.word_cache_size", "1048576", &s_word_cache_size);
+			WordDiffCache::setCapacity(s_word_cache_size);
+			IniSetting::Bind(this, IniSetting::PHP_INI_SYSTEM,
+				"wikidiff2.result_cache_size", "0", &s_result_cache_size);
+			if (s_result_cache_size > 0 && !ResultCache::init(s_result_cache_size)) {
+				raise_warning("Unable to create the wikidiff2 result cache.");
+			}
+			IniSetting::Bind(this, IniSetting::PHP_INI_SYSTEM,
+				"wikidiff2.session_cache_size", "4194304", &s_session_cache_size);
+			DiffSession::setCapacity(s_session_cache_size);
 			HHVM_FE(wikidiff2_do_diff);
 			HHVM_FE(wikidiff2_inline_diff);
+			HHVM_FE(wikidiff2_word_cache_stats);
+			HHVM_FE(wikidiff2_result_cache_stats);
+			HHVM_FE(wikidiff2_batch_diff);
+			HHVM_FE(wikidiff2_blame);
+			HHVM_FE(wikidiff2_session_diff);
+			HHVM_FE(wikidiff2_edit_script);
+			HHVM_FE(wikidiff2_decode_edit_script);
 			loadSystemlib();
+			// Load the Thai dictionary for this thread. Request threads each
+			// load their own when they first meet Thai text.
+			Wikidiff2::initThai();
+		}
+		virtual void moduleShutdown() {
+			Wikidiff2::shutdownThai();
+			ResultCache::shutdown();
 		}
 } s_wikidiff2_extension;
 
@@ -2,11 +2,18 @@
 #define PHP_CPP_ALLOCATOR_H
 
 #include <memory>
+#include <new>
+#include <stdlib.h>
 #include "php.h"
+#include "ThreadPool.h"
 
 /**
  * Allocation class which allows various C++ standard library functions
  * to allocate and free memory using PHP's emalloc/efree facilities.
+ *
+ * On thread pool workers, which PHP knows nothing about, it falls back to
+ * malloc/free. Such memory must be freed on the thread that allocated it,
+ * i.e. it must not outlive the task.
  */
 template <class T>
 class PhpAllocator : public std::allocator<T> 
@@ -27,11 +34,25 @@ class PhpAllocator : public std::allocator<T>
 
 		// Allocate some memory from the PHP request pool
 		pointer allocate(size_type size, typename std::allocator<void>::const_pointer hint = 0) {
+			if (ThreadPool::currentWorker()) {
+				if (size > (size_t)-1 / sizeof(T)) {
+					throw std::bad_alloc();
+				}
+				pointer p = (pointer)malloc(size * sizeof(T));
+				if (!p) {
+					throw std::bad_alloc();
+				}
+				return p;
+			}
 			return (pointer)safe_emalloc(size, sizeof(T), 0);
 		}
 
 		// Free memory
 		void deallocate(pointer p, size_type n) {
+			if (ThreadPool::currentWorker()) {
+				free(p);
+				return;
+			}
 			return efree(p);
 		}
 };
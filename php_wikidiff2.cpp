@@ -11,11 +11,64 @@
 #include "Wikidiff2.h"
 #include "TableDiff.h"
 #include "InlineDiff.h"
+#include "EditScriptDiff.h"
+#include "WordDiffCache.h"
+#include "ResultCache.h"
+#include "BatchDiff.h"
+#include "Blame.h"
+#include "DiffSession.h"
 
 #if PHP_MAJOR_VERSION >= 7
-#define COMPAT_RETURN_STRINGL(s, l) { RETURN_STRINGL(s, l); return; }
+#include "zend_smart_str.h"
 #else
-#define COMPAT_RETURN_STRINGL(s, l) { RETURN_STRINGL(s, l, 1); return; }
+#include "ext/standard/php_smart_str.h"
+#endif
+
+/**
+ * Output sink which appends to a smart_str, which then becomes the return
+ * value without being copied again
+ */
+class SmartStrOutputSink : public OutputSink {
+	public:
+		SmartStrOutputSink() { memset(&str, 0, sizeof(str)); }
+		~SmartStrOutputSink() { smart_str_free(&str); }
+		void write(const char * data, size_t length) { smart_str_appendl(&str, data, length); }
+		void reserve(size_t length) {
+#if PHP_MAJOR_VERSION < 7
+			size_t newlen;
+#endif
+			smart_str_alloc(&str, length, 0);
+		}
+#if PHP_MAJOR_VERSION >= 7
+		const char * data() const { return str.s ? ZSTR_VAL(str.s) : ""; }
+		size_t length() const { return str.s ? ZSTR_LEN(str.s) : 0; }
+#else
+		const char * data() const { return str.c ? str.c : ""; }
+		size_t length() const { return str.len; }
+#endif
+		smart_str str;
+};
+
+#if PHP_MAJOR_VERSION >= 7
+#define COMPAT_RETURN_SMART_STR(sink) { \
+	smart_str_0(&(sink).str); \
+	if ((sink).str.s) { \
+		RETVAL_STR((sink).str.s); \
+		(sink).str.s = NULL; \
+	} else { \
+		RETVAL_EMPTY_STRING(); \
+	} \
+	return; }
+#else
+#define COMPAT_RETURN_SMART_STR(sink) { \
+	smart_str_0(&(sink).str); \
+	if ((sink).str.c) { \
+		RETVAL_STRINGL((sink).str.c, (sink).str.len, 0); \
+		(sink).str.c = NULL; \
+	} else { \
+		RETVAL_EMPTY_STRING(); \
+	} \
+	return; }
 #endif
 
 static int le_wikidiff2;
@@ -23,6 +76,13 @@ static int le_wikidiff2;
 zend_function_entry wikidiff2_functions[] = {
 	PHP_FE(wikidiff2_do_diff,     NULL)
 	PHP_FE(wikidiff2_inline_diff, NULL)
+	PHP_FE(wikidiff2_word_cache_stats, NULL)
+	PHP_FE(wikidiff2_result_cache_stats, NULL)
+	PHP_FE(wikidiff2_batch_diff,  NULL)
+	PHP_FE(wikidiff2_blame,       NULL)
+	PHP_FE(wikidiff2_session_diff, NULL)
+	PHP_FE(wikidiff2_edit_script, NULL)
+	PHP_FE(wikidiff2_decode_edit_script, NULL)
 	{NULL, NULL, NULL}
 };
 
@@ -49,13 +109,41 @@ zend_module_entry wikidiff2_module_entry = {
 ZEND_GET_MODULE(wikidiff2)
 #endif
 
+PHP_INI_BEGIN()
+	PHP_INI_ENTRY("wikidiff2.approximate_threshold", "0", PHP_INI_ALL, NULL)
+	PHP_INI_ENTRY("wikidiff2.detect_moves", "0", PHP_INI_ALL, NULL)
+	PHP_INI_ENTRY("wikidiff2.threads", "0", PHP_INI_SYSTEM, NULL)
+	PHP_INI_ENTRY("wikidiff2.word_cache_size", "1048576", PHP_INI_SYSTEM, NULL)
+	PHP_INI_ENTRY("wikidiff2.result_cache_size", "0", PHP_INI_SYSTEM, NULL)
+	PHP_INI_ENTRY("wikidiff2.session_cache_size", "4194304", PHP_INI_SYSTEM, NULL)
+PHP_INI_END()
+
 PHP_MINIT_FUNCTION(wikidiff2)
 {
+	REGISTER_INI_ENTRIES();
+	REGISTER_LONG_CONSTANT("WIKIDIFF2_ALGORITHM_DAIRIKI", DIFF_ALGORITHM_DAIRIKI,
+		CONST_CS | CONST_PERSISTENT);
+	REGISTER_LONG_CONSTANT("WIKIDIFF2_ALGORITHM_MYERS", DIFF_ALGORITHM_MYERS,
+		CONST_CS | CONST_PERSISTENT);
+	WordDiffCache::setCapacity(INI_INT("wikidiff2.word_cache_size"));
+	DiffSession::setCapacity(INI_INT("wikidiff2.session_cache_size"));
+	// Under FPM this runs in the master process, so the workers inherit the
+	// Thai dictionary instead of each loading it during a request, and share
+	// the result cache
+	Wikidiff2::initThai();
+	if (INI_INT("wikidiff2.result_cache_size") > 0
+		&& !ResultCache::init(INI_INT("wikidiff2.result_cache_size")))
+	{
+		zend_error(E_WARNING, "Unable to create the wikidiff2 result cache.");
+	}
 	return SUCCESS;
 }
 
 PHP_MSHUTDOWN_FUNCTION(wikidiff2)
 {
+	UNREGISTER_INI_ENTRIES();
+	Wikidiff2::shutdownThai();
+	ResultCache::shutdown();
 	return SUCCESS;
 }
 
@@ -75,9 +163,17 @@ PHP_MINFO_FUNCTION(wikidiff2)
 	php_info_print_table_header(2, "wikidiff2 support", "enabled");
 	php_info_print_table_end();
 
+	DISPLAY_INI_ENTRIES();
 }
 
-/* {{{ proto string wikidiff2_do_diff(string text1, string text2, int numContextLines)
+/* {{{ proto string wikidiff2_do_diff(string text1, string text2, int numContextLines [, int algorithm [, int maxWork]])
+ *
+ * algorithm is one of the WIKIDIFF2_ALGORITHM_* constants, by default
+ * WIKIDIFF2_ALGORITHM_DAIRIKI.
+ *
+ * maxWork limits the number of steps the diff engine may take. When it is
+ * reached, the remaining differences are shown as whole changed lines. The
+ * default of zero means no limit.
  *
  * Warning: the input text must be valid UTF-8! Do not pass user input directly
  * to this function.
@@ -91,25 +187,53 @@ PHP_FUNCTION(wikidiff2_do_diff)
 	size_t text1_len;
 	size_t text2_len;
 	zend_long numContextLines;
+	zend_long algorithm = DIFF_ALGORITHM_DAIRIKI;
+	zend_long maxWork = 0;
 #else
 	int text1_len;
 	int text2_len;
 	long numContextLines;
+	long algorithm = DIFF_ALGORITHM_DAIRIKI;
+	long maxWork = 0;
 #endif
 
-	if (zend_parse_parameters(argc TSRMLS_CC, "ssl", &text1, &text1_len, &text2,
-		&text2_len, &numContextLines) == FAILURE)
+	if (zend_parse_parameters(argc TSRMLS_CC, "ssl|ll", &text1, &text1_len, &text2,
+		&text2_len, &numContextLines, &algorithm, &maxWork) == FAILURE)
 	{
 		return;
 	}
+	if (algorithm != DIFF_ALGORITHM_DAIRIKI && algorithm != DIFF_ALGORITHM_MYERS) {
+		zend_error(E_WARNING, "Invalid algorithm passed to wikidiff2_do_diff().");
+		return;
+	}
 
 
 	try {
 		TableDiff wikidiff2;
-		Wikidiff2::String text1String(text1, text1_len);
-		Wikidiff2::String text2String(text2, text2_len);
-		const Wikidiff2::String & ret = wikidiff2.execute(text1String, text2String, (int)numContextLines);
-		COMPAT_RETURN_STRINGL( const_cast<char*>(ret.data()), ret.size());
+		SmartStrOutputSink sink;
+		ResultCache * cache = ResultCache::getShared();
+		ResultCache::Key key;
+		if (cache) {
+			key = cache->makeKey(text1, text1_len, text2, text2_len, ResultCache::FORMAT_TABLE,
+				(int)numContextLines, (int)algorithm, maxWork,
+				INI_INT("wikidiff2.approximate_threshold"), INI_INT("wikidiff2.detect_moves"));
+			if (cache->lookup(key, sink)) {
+				COMPAT_RETURN_SMART_STR(sink);
+			}
+		}
+		wikidiff2.setOutputSink(&sink);
+		wikidiff2.setAlgorithm((DiffAlgorithm)algorithm);
+		wikidiff2.setMaxWork(maxWork);
+		wikidiff2.setApproximateThreshold(INI_INT("wikidiff2.approximate_threshold"));
+		wikidiff2.setDetectMoves(INI_INT("wikidiff2.detect_moves"));
+		if (INI_INT("wikidiff2.threads") > 0) {
+			wikidiff2.setThreadPool(&ThreadPool::getShared(INI_INT("wikidiff2.threads")));
+		}
+		wikidiff2.execute(text1, text1_len, text2, text2_len, (int)numContextLines);
+		if (cache) {
+			cache->store(key, sink.data(), sink.length());
+		}
+		COMPAT_RETURN_SMART_STR(sink);
 	} catch (std::bad_alloc &e) {
 		zend_error(E_WARNING, "Out of memory in wikidiff2_do_diff().");
 	} catch (...) {
@@ -117,7 +241,14 @@ PHP_FUNCTION(wikidiff2_do_diff)
 	}
 }
 
-/* {{{ proto string wikidiff2_inline_diff(string text1, string text2, int numContextLines)
+/* {{{ proto string wikidiff2_inline_diff(string text1, string text2, int numContextLines [, int algorithm [, int maxWork]])
+ *
+ * algorithm is one of the WIKIDIFF2_ALGORITHM_* constants, by default
+ * WIKIDIFF2_ALGORITHM_DAIRIKI.
+ *
+ * maxWork limits the number of steps the diff engine may take. When it is
+ * reached, the remaining differences are shown as whole changed lines. The
+ * default of zero means no limit.
  *
  * Warning: the input text must be valid UTF-8! Do not pass user input directly
  * to this function.
@@ -131,25 +262,53 @@ PHP_FUNCTION(wikidiff2_inline_diff)
 	size_t text1_len;
 	size_t text2_len;
 	zend_long numContextLines;
+	zend_long algorithm = DIFF_ALGORITHM_DAIRIKI;
+	zend_long maxWork = 0;
 #else
 	int text1_len;
 	int text2_len;
 	long numContextLines;
+	long algorithm = DIFF_ALGORITHM_DAIRIKI;
+	long maxWork = 0;
 #endif
 
-	if (zend_parse_parameters(argc TSRMLS_CC, "ssl", &text1, &text1_len, &text2,
-		&text2_len, &numContextLines) == FAILURE)
+	if (zend_parse_parameters(argc TSRMLS_CC, "ssl|ll", &text1, &text1_len, &text2,
+		&text2_len, &numContextLines, &algorithm, &maxWork) == FAILURE)
 	{
 		return;
 	}
+	if (algorithm != DIFF_ALGORITHM_DAIRIKI && algorithm != DIFF_ALGORITHM_MYERS) {
+		zend_error(E_WARNING, "Invalid algorithm passed to wikidiff2_inline_diff().");
+		return;
+	}
 
 
 	try {
 		InlineDiff wikidiff2;
-		Wikidiff2::String text1String(text1, text1_len);
-		Wikidiff2::String text2String(text2, text2_len);
-		const Wikidiff2::String& ret = wikidiff2.execute(text1String, text2String, (int)numContextLines);
-		COMPAT_RETURN_STRINGL( const_cast<char*>(ret.data()), ret.size());
+		SmartStrOutputSink sink;
+		ResultCache * cache = ResultCache::getShared();
+		ResultCache::Key key;
+		if (cache) {
+			key = cache->makeKey(text1, text1_len, text2, text2_len, ResultCache::FORMAT_INLINE,
+				(int)numContextLines, (int)algorithm, maxWork,
+				INI_INT("wikidiff2.approximate_threshold"), INI_INT("wikidiff2.detect_moves"));
+			if (cache->lookup(key, sink)) {
+				COMPAT_RETURN_SMART_STR(sink);
+			}
+		}
+		wikidiff2.setOutputSink(&sink);
+		wikidiff2.setAlgorithm((DiffAlgorithm)algorithm);
+		wikidiff2.setMaxWork(maxWork);
+		wikidiff2.setApproximateThreshold(INI_INT("wikidiff2.approximate_threshold"));
+		wikidiff2.setDetectMoves(INI_INT("wikidiff2.detect_moves"));
+		if (INI_INT("wikidiff2.threads") > 0) {
+			wikidiff2.setThreadPool(&ThreadPool::getShared(INI_INT("wikidiff2.threads")));
+		}
+		wikidiff2.execute(text1, text1_len, text2, text2_len, (int)numContextLines);
+		if (cache) {
+			cache->store(key, sink.data(), sink.length());
+		}
+		COMPAT_RETURN_SMART_STR(sink);
 	} catch (std::bad_alloc &e) {
 		zend_error(E_WARNING, "Out of memory in wikidiff2_inline_diff().");
 	} catch (...) {
@@ -157,6 +316,612 @@ PHP_FUNCTION(wikidiff2_inline_diff)
 	}
 }
 
+/* {{{ proto string wikidiff2_edit_script(string text1, string text2, int numContextLines [, int algorithm [, int maxWork]])
+ *
+ * Get the diff as a compact binary edit script, with the changed lines and
+ * words as byte ranges into the two texts, rather than as HTML. It can be
+ * read with wikidiff2_decode_edit_script(). The format is described in
+ * EditScriptDiff.h.
+ *
+ * algorithm is one of the WIKIDIFF2_ALGORITHM_* constants, by default
+ * WIKIDIFF2_ALGORITHM_DAIRIKI.
+ *
+ * maxWork limits the number of steps the diff engine may take. When it is
+ * reached, the remaining differences are shown as whole changed lines. The
+ * default of zero means no limit.
+ *
+ * Warning: the input text must be valid UTF-8! Do not pass user input directly
+ * to this function.
+ */
+PHP_FUNCTION(wikidiff2_edit_script)
+{
+	char *text1 = NULL;
+	char *text2 = NULL;
+	int argc = ZEND_NUM_ARGS();
+#if PHP_MAJOR_VERSION >= 7
+	size_t text1_len;
+	size_t text2_len;
+	zend_long numContextLines;
+	zend_long algorithm = DIFF_ALGORITHM_DAIRIKI;
+	zend_long maxWork = 0;
+#else
+	int text1_len;
+	int text2_len;
+	long numContextLines;
+	long algorithm = DIFF_ALGORITHM_DAIRIKI;
+	long maxWork = 0;
+#endif
+
+	if (zend_parse_parameters(argc TSRMLS_CC, "ssl|ll", &text1, &text1_len, &text2,
+		&text2_len, &numContextLines, &algorithm, &maxWork) == FAILURE)
+	{
+		return;
+	}
+	if (algorithm != DIFF_ALGORITHM_DAIRIKI && algorithm != DIFF_ALGORITHM_MYERS) {
+		zend_error(E_WARNING, "Invalid algorithm passed to wikidiff2_edit_script().");
+		return;
+	}
+
+
+	try {
+		EditScriptDiff wikidiff2;
+		SmartStrOutputSink sink;
+		ResultCache * cache = ResultCache::getShared();
+		ResultCache::Key key;
+		if (cache) {
+			key = cache->makeKey(text1, text1_len, text2, text2_len, ResultCache::FORMAT_EDIT_SCRIPT,
+				(int)numContextLines, (int)algorithm, maxWork,
+				INI_INT("wikidiff2.approximate_threshold"), INI_INT("wikidiff2.detect_moves"));
+			if (cache->lookup(key, sink)) {
+				COMPAT_RETURN_SMART_STR(sink);
+			}
+		}
+		wikidiff2.setOutputSink(&sink);
+		wikidiff2.setAlgorithm((DiffAlgorithm)algorithm);
+		wikidiff2.setMaxWork(maxWork);
+		wikidiff2.setApproximateThreshold(INI_INT("wikidiff2.approximate_threshold"));
+		wikidiff2.setDetectMoves(INI_INT("wikidiff2.detect_moves"));
+		if (INI_INT("wikidiff2.threads") > 0) {
+			wikidiff2.setThreadPool(&ThreadPool::getShared(INI_INT("wikidiff2.threads")));
+		}
+		wikidiff2.execute(text1, text1_len, text2, text2_len, (int)numContextLines);
+		if (cache) {
+			cache->store(key, sink.data(), sink.length());
+		}
+		COMPAT_RETURN_SMART_STR(sink);
+	} catch (std::bad_alloc &e) {
+		zend_error(E_WARNING, "Out of memory in wikidiff2_edit_script().");
+	} catch (...) {
+		zend_error(E_WARNING, "Unknown exception in wikidiff2_edit_script().");
+	}
+}
+
+/* {{{ proto array wikidiff2_word_cache_stats()
+ *
+ * Get the number of word diffs found in and missing from the word diff
+ * cache, as an array with the keys "hits" and "misses". The counts are for
+ * the whole process, since it started.
+ */
+PHP_FUNCTION(wikidiff2_word_cache_stats)
+{
+	if (zend_parse_parameters_none() == FAILURE) {
+		return;
+	}
+	array_init(return_value);
+	add_assoc_long(return_value, "hits", (long)WordDiffCache::getHits());
+	add_assoc_long(return_value, "misses", (long)WordDiffCache::getMisses());
+}
+
+/* {{{ proto array wikidiff2_result_cache_stats()
+ *
+ * Get the number of diffs found in and missing from the shared result
+ * cache, as an array with the keys "hits" and "misses". The cache is shared
+ * by all worker processes, but the counts are for this process only, since
+ * it started.
+ */
+PHP_FUNCTION(wikidiff2_result_cache_stats)
+{
+	if (zend_parse_parameters_none() == FAILURE) {
+		return;
+	}
+	array_init(return_value);
+	add_assoc_long(return_value, "hits", (long)ResultCache::getHits());
+	add_assoc_long(return_value, "misses", (long)ResultCache::getMisses());
+}
+
+/**
+ * Find an element of an array by key, or return NULL
+ */
+static zval * wikidiff2_find_key(HashTable * array, const char * key)
+{
+#if PHP_MAJOR_VERSION >= 7
+	return zend_hash_str_find(array, key, strlen(key));
+#else
+	zval ** value;
+	if (zend_hash_find(array, key, strlen(key) + 1, (void**)&value) == SUCCESS) {
+		return *value;
+	}
+	return NULL;
+#endif
+}
+
+/**
+ * Find an element of an array by index, or return NULL
+ */
+static zval * wikidiff2_find_index(HashTable * array, long index)
+{
+#if PHP_MAJOR_VERSION >= 7
+	return zend_hash_index_find(array, index);
+#else
+	zval ** value;
+	if (zend_hash_index_find(array, index, (void**)&value) == SUCCESS) {
+		return *value;
+	}
+	return NULL;
+#endif
+}
+
+/**
+ * Get an integer option, leaving value alone if it is not given. Returns
+ * false if it is given but is not an integer.
+ */
+template<typename T>
+static bool wikidiff2_get_long_option(HashTable * options, const char * key, T & value)
+{
+	zval * option = options ? wikidiff2_find_key(options, key) : NULL;
+	if (!option) {
+		return true;
+	}
+	if (Z_TYPE_P(option) != IS_LONG) {
+		return false;
+	}
+	value = Z_LVAL_P(option);
+	return true;
+}
+
+/* {{{ proto array wikidiff2_batch_diff(array pairs [, array options])
+ *
+ * Diff many pairs of texts, e.g. consecutive revisions, in one call. Each
+ * element of pairs is an array of the two texts. The diffs are returned as
+ * an array of strings, in the same order.
+ *
+ * The options are:
+ *   - format: "table" as for wikidiff2_do_diff(), the default, "inline" as
+ *     for wikidiff2_inline_diff(), or "editscript" as for
+ *     wikidiff2_edit_script()
+ *   - numContextLines: the number of context lines, by default 2
+ *   - algorithm: one of the WIKIDIFF2_ALGORITHM_* constants
+ *   - maxWork: the work limit for each pair, as for wikidiff2_do_diff()
+ *
+ * This is faster than diffing each pair separately. The setup is only done
+ * once, pairs are diffed in parallel when wikidiff2.threads is set, and when
+ * a pair's first text is the same string as the previous pair's second
+ * text, it is only split into lines once.
+ *
+ * Warning: the input text must be valid UTF-8! Do not pass user input directly
+ * to this function.
+ */
+PHP_FUNCTION(wikidiff2_batch_diff)
+{
+	zval *zpairs = NULL;
+	zval *zoptions = NULL;
+	int argc = ZEND_NUM_ARGS();
+#if PHP_MAJOR_VERSION >= 7
+	zend_long numContextLines = 2;
+	zend_long algorithm = DIFF_ALGORITHM_DAIRIKI;
+	zend_long maxWork = 0;
+#else
+	long numContextLines = 2;
+	long algorithm = DIFF_ALGORITHM_DAIRIKI;
+	long maxWork = 0;
+#endif
+	BatchDiff::Format format = BatchDiff::FORMAT_TABLE;
+
+	if (zend_parse_parameters(argc TSRMLS_CC, "a|a", &zpairs, &zoptions) == FAILURE) {
+		return;
+	}
+	HashTable * options = zoptions ? Z_ARRVAL_P(zoptions) : NULL;
+	zval * zformat = options ? wikidiff2_find_key(options, "format") : NULL;
+	if (zformat) {
+		if (Z_TYPE_P(zformat) == IS_STRING && !strcmp(Z_STRVAL_P(zformat), "inline")) {
+			format = BatchDiff::FORMAT_INLINE;
+		} else if (Z_TYPE_P(zformat) == IS_STRING && !strcmp(Z_STRVAL_P(zformat), "editscript")) {
+			format = BatchDiff::FORMAT_EDIT_SCRIPT;
+		} else if (Z_TYPE_P(zformat) != IS_STRING || strcmp(Z_STRVAL_P(zformat), "table")) {
+			zend_error(E_WARNING, "Invalid format passed to wikidiff2_batch_diff().");
+			return;
+		}
+	}
+	if (!wikidiff2_get_long_option(options, "numContextLines", numContextLines)
+		|| !wikidiff2_get_long_option(options, "algorithm", algorithm)
+		|| !wikidiff2_get_long_option(options, "maxWork", maxWork)
+		|| (algorithm != DIFF_ALGORITHM_DAIRIKI && algorithm != DIFF_ALGORITHM_MYERS))
+	{
+		zend_error(E_WARNING, "Invalid option passed to wikidiff2_batch_diff().");
+		return;
+	}
+
+	try {
+		BatchDiff::PairVector pairs;
+		HashTable * pairArray = Z_ARRVAL_P(zpairs);
+		pairs.reserve(zend_hash_num_elements(pairArray));
+#if PHP_MAJOR_VERSION >= 7
+		zval * zpair;
+		ZEND_HASH_FOREACH_VAL(pairArray, zpair) {
+#else
+		HashPosition pos;
+		zval ** zpairp;
+		for (zend_hash_internal_pointer_reset_ex(pairArray, &pos);
+			zend_hash_get_current_data_ex(pairArray, (void**)&zpairp, &pos) == SUCCESS;
+			zend_hash_move_forward_ex(pairArray, &pos))
+		{
+			zval * zpair = *zpairp;
+#endif
+			zval * text1 = Z_TYPE_P(zpair) == IS_ARRAY
+				? wikidiff2_find_index(Z_ARRVAL_P(zpair), 0) : NULL;
+			zval * text2 = Z_TYPE_P(zpair) == IS_ARRAY
+				? wikidiff2_find_index(Z_ARRVAL_P(zpair), 1) : NULL;
+			if (!text1 || !text2 || Z_TYPE_P(text1) != IS_STRING
+				|| Z_TYPE_P(text2) != IS_STRING)
+			{
+				zend_error(E_WARNING, "Invalid pair passed to wikidiff2_batch_diff().");
+				return;
+			}
+			pairs.push_back(BatchDiff::Pair(Z_STRVAL_P(text1), Z_STRLEN_P(text1),
+				Z_STRVAL_P(text2), Z_STRLEN_P(text2)));
+#if PHP_MAJOR_VERSION >= 7
+		} ZEND_HASH_FOREACH_END();
+#else
+		}
+#endif
+
+		BatchDiff batch(format, (int)numContextLines);
+		batch.setAlgorithm((DiffAlgorithm)algorithm);
+		batch.setMaxWork(maxWork);
+		batch.setApproximateThreshold(INI_INT("wikidiff2.approximate_threshold"));
+		batch.setDetectMoves(INI_INT("wikidiff2.detect_moves"));
+		batch.setResultCache(ResultCache::getShared());
+		if (INI_INT("wikidiff2.threads") > 0) {
+			batch.setThreadPool(&ThreadPool::getShared(INI_INT("wikidiff2.threads")));
+		}
+		batch.execute(pairs);
+
+		array_init(return_value);
+		for (size_t i = 0; i < pairs.size(); i++) {
+#if PHP_MAJOR_VERSION >= 7
+			add_next_index_stringl(return_value, pairs[i].result.data(), pairs[i].result.size());
+#else
+			add_next_index_stringl(return_value, (char*)pairs[i].result.data(),
+				pairs[i].result.size(), 1);
+#endif
+		}
+	} catch (std::bad_alloc &e) {
+		zend_error(E_WARNING, "Out of memory in wikidiff2_batch_diff().");
+	} catch (...) {
+		zend_error(E_WARNING, "Unknown exception in wikidiff2_batch_diff().");
+	}
+}
+
+/* {{{ proto array wikidiff2_blame(array revisions [, array options])
+ *
+ * Find the revision which added each line or word of a page. The revisions
+ * are given as an array of texts, oldest first. The result is an array with
+ * two arrays of integers, for the lines or words of the last revision:
+ * "offsets", the byte offset at which each starts, running up to the next,
+ * and "origins", the index in revisions of the revision which added it.
+ *
+ * The options are:
+ *   - level: "line", the default, or "word"
+ *   - algorithm: one of the WIKIDIFF2_ALGORITHM_* constants
+ *
+ * Warning: the input text must be valid UTF-8! Do not pass user input directly
+ * to this function.
+ */
+PHP_FUNCTION(wikidiff2_blame)
+{
+	zval *zrevisions = NULL;
+	zval *zoptions = NULL;
+	int argc = ZEND_NUM_ARGS();
+#if PHP_MAJOR_VERSION >= 7
+	zend_long algorithm = DIFF_ALGORITHM_DAIRIKI;
+#else
+	long algorithm = DIFF_ALGORITHM_DAIRIKI;
+#endif
+	Blame::Level level = Blame::LEVEL_LINE;
+
+	if (zend_parse_parameters(argc TSRMLS_CC, "a|a", &zrevisions, &zoptions) == FAILURE) {
+		return;
+	}
+	HashTable * options = zoptions ? Z_ARRVAL_P(zoptions) : NULL;
+	zval * zlevel = options ? wikidiff2_find_key(options, "level") : NULL;
+	if (zlevel) {
+		if (Z_TYPE_P(zlevel) == IS_STRING && !strcmp(Z_STRVAL_P(zlevel), "word")) {
+			level = Blame::LEVEL_WORD;
+		} else if (Z_TYPE_P(zlevel) != IS_STRING || strcmp(Z_STRVAL_P(zlevel), "line")) {
+			zend_error(E_WARNING, "Invalid level passed to wikidiff2_blame().");
+			return;
+		}
+	}
+	if (!wikidiff2_get_long_option(options, "algorithm", algorithm)
+		|| (algorithm != DIFF_ALGORITHM_DAIRIKI && algorithm != DIFF_ALGORITHM_MYERS))
+	{
+		zend_error(E_WARNING, "Invalid algorithm passed to wikidiff2_blame().");
+		return;
+	}
+
+	try {
+		Blame blame(level);
+		blame.setAlgorithm((DiffAlgorithm)algorithm);
+		HashTable * revisions = Z_ARRVAL_P(zrevisions);
+#if PHP_MAJOR_VERSION >= 7
+		zval * revision;
+		ZEND_HASH_FOREACH_VAL(revisions, revision) {
+#else
+		HashPosition pos;
+		zval ** revisionp;
+		for (zend_hash_internal_pointer_reset_ex(revisions, &pos);
+			zend_hash_get_current_data_ex(revisions, (void**)&revisionp, &pos) == SUCCESS;
+			zend_hash_move_forward_ex(revisions, &pos))
+		{
+			zval * revision = *revisionp;
+#endif
+			if (Z_TYPE_P(revision) != IS_STRING) {
+				zend_error(E_WARNING, "Invalid revision passed to wikidiff2_blame().");
+				return;
+			}
+			blame.addRevision(Z_STRVAL_P(revision), Z_STRLEN_P(revision));
+#if PHP_MAJOR_VERSION >= 7
+		} ZEND_HASH_FOREACH_END();
+#else
+		}
+#endif
+
+		Blame::IndexVector offsets;
+		blame.getOffsets(offsets);
+		const Blame::IndexVector & origins = blame.getOrigins();
+#if PHP_MAJOR_VERSION >= 7
+		zval zoffsets, zorigins;
+		array_init_size(&zoffsets, offsets.size());
+		array_init_size(&zorigins, origins.size());
+		for (size_t i = 0; i < offsets.size(); i++) {
+			add_next_index_long(&zoffsets, offsets[i]);
+			add_next_index_long(&zorigins, origins[i]);
+		}
+		array_init(return_value);
+		add_assoc_zval(return_value, "offsets", &zoffsets);
+		add_assoc_zval(return_value, "origins", &zorigins);
+#else
+		zval * zoffsets, * zorigins;
+		MAKE_STD_ZVAL(zoffsets);
+		MAKE_STD_ZVAL(zorigins);
+		array_init_size(zoffsets, offsets.size());
+		array_init_size(zorigins, origins.size());
+		for (size_t i = 0; i < offsets.size(); i++) {
+			add_next_index_long(zoffsets, offsets[i]);
+			add_next_index_long(zorigins, origins[i]);
+		}
+		array_init(return_value);
+		add_assoc_zval(return_value, "offsets", zoffsets);
+		add_assoc_zval(return_value, "origins", zorigins);
+#endif
+	} catch (std::bad_alloc &e) {
+		zend_error(E_WARNING, "Out of memory in wikidiff2_blame().");
+	} catch (...) {
+		zend_error(E_WARNING, "Unknown exception in wikidiff2_blame().");
+	}
+}
+
+/* {{{ proto string wikidiff2_session_diff(string key, string base, string draft [, array options])
+ *
+ * Diff a base text with a draft, as wikidiff2_do_diff() or
+ * wikidiff2_inline_diff() would, remembering both under the given key, e.g.
+ * an edit session ID. The next call with the same key and base text only
+ * diffs again what changed in the draft since this call, which makes live
+ * previews of an edit cheap. Sessions are kept by each worker thread or
+ * process, up to wikidiff2.session_cache_size bytes.
+ *
+ * The options are:
+ *   - format: "table", the default, "inline" or "editscript"
+ *   - numContextLines: the number of context lines, by default 2
+ *   - algorithm: one of the WIKIDIFF2_ALGORITHM_* constants
+ *   - maxWork: the work limit, as for wikidiff2_do_diff()
+ *
+ * Warning: the input text must be valid UTF-8! Do not pass user input directly
+ * to this function.
+ */
+PHP_FUNCTION(wikidiff2_session_diff)
+{
+	char *key = NULL;
+	char *base = NULL;
+	char *draft = NULL;
+	zval *zoptions = NULL;
+	int argc = ZEND_NUM_ARGS();
+#if PHP_MAJOR_VERSION >= 7
+	size_t key_len;
+	size_t base_len;
+	size_t draft_len;
+	zend_long numContextLines = 2;
+	zend_long algorithm = DIFF_ALGORITHM_DAIRIKI;
+	zend_long maxWork = 0;
+#else
+	int key_len;
+	int base_len;
+	int draft_len;
+	long numContextLines = 2;
+	long algorithm = DIFF_ALGORITHM_DAIRIKI;
+	long maxWork = 0;
+#endif
+	int format = ResultCache::FORMAT_TABLE;
+
+	if (zend_parse_parameters(argc TSRMLS_CC, "sss|a", &key, &key_len, &base, &base_len,
+		&draft, &draft_len, &zoptions) == FAILURE)
+	{
+		return;
+	}
+	HashTable * options = zoptions ? Z_ARRVAL_P(zoptions) : NULL;
+	zval * zformat = options ? wikidiff2_find_key(options, "format") : NULL;
+	if (zformat) {
+		if (Z_TYPE_P(zformat) == IS_STRING && !strcmp(Z_STRVAL_P(zformat), "inline")) {
+			format = ResultCache::FORMAT_INLINE;
+		} else if (Z_TYPE_P(zformat) == IS_STRING && !strcmp(Z_STRVAL_P(zformat), "editscript")) {
+			format = ResultCache::FORMAT_EDIT_SCRIPT;
+		} else if (Z_TYPE_P(zformat) != IS_STRING || strcmp(Z_STRVAL_P(zformat), "table")) {
+			zend_error(E_WARNING, "Invalid format passed to wikidiff2_session_diff().");
+			return;
+		}
+	}
+	if (!wikidiff2_get_long_option(options, "numContextLines", numContextLines)
+		|| !wikidiff2_get_long_option(options, "algorithm", algorithm)
+		|| !wikidiff2_get_long_option(options, "maxWork", maxWork)
+		|| (algorithm != DIFF_ALGORITHM_DAIRIKI && algorithm != DIFF_ALGORITHM_MYERS))
+	{
+		zend_error(E_WARNING, "Invalid option passed to wikidiff2_session_diff().");
+		return;
+	}
+
+	try {
+		TableDiff tableDiff;
+		InlineDiff inlineDiff;
+		EditScriptDiff editScriptDiff;
+		Wikidiff2 & wikidiff2 = format == ResultCache::FORMAT_INLINE ? (Wikidiff2&)inlineDiff
+			: format == ResultCache::FORMAT_EDIT_SCRIPT ? (Wikidiff2&)editScriptDiff
+			: (Wikidiff2&)tableDiff;
+		SmartStrOutputSink sink;
+		std::shared_ptr<DiffSession> session =
+			DiffSession::open(std::string(key, key_len), base, base_len);
+		wikidiff2.setOutputSink(&sink);
+		wikidiff2.setAlgorithm((DiffAlgorithm)algorithm);
+		wikidiff2.setMaxWork(maxWork);
+		wikidiff2.setDetectMoves(INI_INT("wikidiff2.detect_moves"));
+		if (INI_INT("wikidiff2.threads") > 0) {
+			wikidiff2.setThreadPool(&ThreadPool::getShared(INI_INT("wikidiff2.threads")));
+		}
+		wikidiff2.execute(*session, draft, draft_len, (int)numContextLines);
+		COMPAT_RETURN_SMART_STR(sink);
+	} catch (std::bad_alloc &e) {
+		zend_error(E_WARNING, "Out of memory in wikidiff2_session_diff().");
+	} catch (...) {
+		zend_error(E_WARNING, "Unknown exception in wikidiff2_session_diff().");
+	}
+}
+
+static const char * const wikidiff2_record_names[] = {
+	NULL, "block", "context", "delete", "add", "change", "move-delete", "move-add"
+};
+static const char * const wikidiff2_word_op_names[] = { "copy", "delete", "add", "change" };
+
+/**
+ * Fill an array with the op name and the byte ranges of a decoded edit
+ * script record or word op, leaving out a side it doesn't have
+ */
+static void wikidiff2_add_ranges(zval * array, const char * op, size_t from, size_t fromLength,
+		size_t to, size_t toLength, bool hasFrom, bool hasTo)
+{
+#if PHP_MAJOR_VERSION >= 7
+	add_assoc_string(array, "op", (char*)op);
+#else
+	add_assoc_string(array, "op", (char*)op, 1);
+#endif
+	if (hasFrom) {
+		add_assoc_long(array, "from", from);
+		add_assoc_long(array, "fromLength", fromLength);
+	}
+	if (hasTo) {
+		add_assoc_long(array, "to", to);
+		add_assoc_long(array, "toLength", toLength);
+	}
+}
+
+/* {{{ proto array wikidiff2_decode_edit_script(string script)
+ *
+ * Decode the output of wikidiff2_edit_script() into an array of records,
+ * each an array with an "op" of "block", "context", "delete", "add",
+ * "change", "move-delete" or "move-add". A block, which starts each group
+ * of changes, has the line numbers "leftLine" and "rightLine". The others
+ * have the byte offsets and lengths "from" and "fromLength" in the old text,
+ * and "to" and "toLength" in the new, if they have that side. A change or
+ * move also has "words", an array of word ops with an "op" of "copy",
+ * "delete", "add" or "change", and offsets and lengths in the same way.
+ *
+ * Returns false if the script is invalid or of another version.
+ */
+PHP_FUNCTION(wikidiff2_decode_edit_script)
+{
+	char *script = NULL;
+	int argc = ZEND_NUM_ARGS();
+#if PHP_MAJOR_VERSION >= 7
+	size_t script_len;
+#else
+	int script_len;
+#endif
+
+	if (zend_parse_parameters(argc TSRMLS_CC, "s", &script, &script_len) == FAILURE) {
+		return;
+	}
+
+	try {
+		EditScriptDiff::RecordVector records;
+		EditScriptDiff::WordRecordVector words;
+		if (!EditScriptDiff::decode(script, script_len, records, words)) {
+			zend_error(E_WARNING, "Invalid script passed to wikidiff2_decode_edit_script().");
+			RETURN_FALSE;
+		}
+		array_init_size(return_value, records.size());
+		for (size_t i = 0; i < records.size(); i++) {
+			const EditScriptDiff::Record & record = records[i];
+			const char * name = wikidiff2_record_names[record.type];
+#if PHP_MAJOR_VERSION >= 7
+			zval zrecord_value, zwords_value;
+			zval * zrecord = &zrecord_value, * zwords = &zwords_value;
+#else
+			zval * zrecord, * zwords;
+			MAKE_STD_ZVAL(zrecord);
+#endif
+			array_init(zrecord);
+			if (record.type == EditScriptDiff::RECORD_BLOCK) {
+#if PHP_MAJOR_VERSION >= 7
+				add_assoc_string(zrecord, "op", (char*)name);
+#else
+				add_assoc_string(zrecord, "op", (char*)name, 1);
+#endif
+				add_assoc_long(zrecord, "leftLine", record.from);
+				add_assoc_long(zrecord, "rightLine", record.to);
+			} else {
+				wikidiff2_add_ranges(zrecord, name, record.from, record.fromLength, record.to,
+					record.toLength, record.type != EditScriptDiff::RECORD_ADD,
+					record.type != EditScriptDiff::RECORD_DELETE);
+			}
+			if (record.type >= EditScriptDiff::RECORD_CHANGE) {
+#if PHP_MAJOR_VERSION < 7
+				MAKE_STD_ZVAL(zwords);
+#endif
+				array_init_size(zwords, record.numWords);
+				for (size_t j = record.firstWord; j < record.firstWord + record.numWords; j++) {
+					const EditScriptDiff::WordRecord & word = words[j];
+#if PHP_MAJOR_VERSION >= 7
+					zval zword_value;
+					zval * zword = &zword_value;
+#else
+					zval * zword;
+					MAKE_STD_ZVAL(zword);
+#endif
+					array_init(zword);
+					wikidiff2_add_ranges(zword, wikidiff2_word_op_names[word.op], word.from,
+						word.fromLength, word.to, word.toLength,
+						word.op != DiffOp<Word>::add, word.op != DiffOp<Word>::del);
+					add_next_index_zval(zwords, zword);
+				}
+				add_assoc_zval(zrecord, "words", zwords);
+			}
+			add_next_index_zval(return_value, zrecord);
+		}
+	} catch (std::bad_alloc &e) {
+		zend_error(E_WARNING, "Out of memory in wikidiff2_decode_edit_script().");
+	} catch (...) {
+		zend_error(E_WARNING, "Unknown exception in wikidiff2_decode_edit_script().");
+	}
+}
+
 /* }}} */
 
 
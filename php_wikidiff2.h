@@ -44,6 +44,13 @@ PHP_MINFO_FUNCTION(wikidiff2);
 
 PHP_FUNCTION(wikidiff2_do_diff);
 PHP_FUNCTION(wikidiff2_inline_diff);
+PHP_FUNCTION(wikidiff2_word_cache_stats);
+PHP_FUNCTION(wikidiff2_result_cache_stats);
+PHP_FUNCTION(wikidiff2_batch_diff);
+PHP_FUNCTION(wikidiff2_blame);
+PHP_FUNCTION(wikidiff2_session_diff);
+PHP_FUNCTION(wikidiff2_edit_script);
+PHP_FUNCTION(wikidiff2_decode_edit_script);
 
 
 
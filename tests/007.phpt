@@ -0,0 +1,79 @@
+--TEST--
+Diff test G: Myers algorithm
+--SKIPIF--
+<?php if (!extension_loaded("wikidiff2")) print "skip"; ?>
+--FILE--
+<?php
+$x = <<<EOT
+== Heading ==
+
+Some text.
+a
+c
+a
+EOT;
+
+#---------------------------------------------------
+
+$y = <<<EOT
+== Heading ==
+c
+Some text.
+a
+b
+EOT;
+
+#---------------------------------------------------
+
+print wikidiff2_do_diff( $x, $y, 1, WIKIDIFF2_ALGORITHM_MYERS );
+
+?>
+--EXPECT--
+<tr>
+  <td colspan="2" class="diff-lineno"><!--LINE 1--></td>
+  <td colspan="2" class="diff-lineno"><!--LINE 1--></td>
+</tr>
+<tr>
+  <td class="diff-marker">&#160;</td>
+  <td class="diff-context"><div>== Heading ==</div></td>
+  <td class="diff-marker">&#160;</td>
+  <td class="diff-context"><div>== Heading ==</div></td>
+</tr>
+<tr>
+  <td class="diff-marker">−</td>
+  <td class="diff-deletedline"></td>
+  <td colspan="2" class="diff-empty">&#160;</td>
+</tr>
+<tr>
+  <td class="diff-marker">−</td>
+  <td class="diff-deletedline"><div>Some text.</div></td>
+  <td colspan="2" class="diff-empty">&#160;</td>
+</tr>
+<tr>
+  <td class="diff-marker">−</td>
+  <td class="diff-deletedline"><div>a</div></td>
+  <td colspan="2" class="diff-empty">&#160;</td>
+</tr>
+<tr>
+  <td class="diff-marker">&#160;</td>
+  <td class="diff-context"><div>c</div></td>
+  <td class="diff-marker">&#160;</td>
+  <td class="diff-context"><div>c</div></td>
+</tr>
+<tr>
+  <td colspan="2" class="diff-empty">&#160;</td>
+  <td class="diff-marker">+</td>
+  <td class="diff-addedline"><div>Some text.</div></td>
+</tr>
+<tr>
+  <td class="diff-marker">&#160;</td>
+  <td class="diff-context"><div>a</div></td>
+  <td class="diff-marker">&#160;</td>
+  <td class="diff-context"><div>a</div></td>
+</tr>
+<tr>
+  <td colspan="2" class="diff-empty">&#160;</td>
+  <td class="diff-marker">+</td>
+  <td class="diff-addedline"><div>b</div></td>
+</tr>
+
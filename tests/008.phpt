@@ -0,0 +1,63 @@
+--TEST--
+Diff test H: work limit
+--SKIPIF--
+<?php if (!extension_loaded("wikidiff2")) print "skip"; ?>
+--FILE--
+<?php
+$x = <<<EOT
+unchanged
+one
+two
+three
+four
+EOT;
+
+#---------------------------------------------------
+
+$y = <<<EOT
+unchanged
+two
+one
+three four
+EOT;
+
+#---------------------------------------------------
+
+print wikidiff2_do_diff( $x, $y, 2, WIKIDIFF2_ALGORITHM_DAIRIKI, 1 );
+
+?>
+--EXPECT--
+<tr>
+  <td colspan="2" class="diff-lineno"><!--LINE 1--></td>
+  <td colspan="2" class="diff-lineno"><!--LINE 1--></td>
+</tr>
+<tr>
+  <td class="diff-marker">&#160;</td>
+  <td class="diff-context"><div>unchanged</div></td>
+  <td class="diff-marker">&#160;</td>
+  <td class="diff-context"><div>unchanged</div></td>
+</tr>
+<tr>
+  <td class="diff-marker">−</td>
+  <td class="diff-deletedline"><div><del class="diffchange diffchange-inline">one</del></div></td>
+  <td class="diff-marker">+</td>
+  <td class="diff-addedline"><div><ins class="diffchange diffchange-inline">two</ins></div></td>
+</tr>
+<tr>
+  <td class="diff-marker">−</td>
+  <td class="diff-deletedline"><div><del class="diffchange diffchange-inline">two</del></div></td>
+  <td class="diff-marker">+</td>
+  <td class="diff-addedline"><div><ins class="diffchange diffchange-inline">one</ins></div></td>
+</tr>
+<tr>
+  <td class="diff-marker">−</td>
+  <td class="diff-deletedline"><div><del class="diffchange diffchange-inline">three</del></div></td>
+  <td class="diff-marker">+</td>
+  <td class="diff-addedline"><div><ins class="diffchange diffchange-inline">three four</ins></div></td>
+</tr>
+<tr>
+  <td class="diff-marker">−</td>
+  <td class="diff-deletedline"><div>four</div></td>
+  <td colspan="2" class="diff-empty">&#160;</td>
+</tr>
+
@@ -0,0 +1,60 @@
+--TEST--
+Diff test I: word diff cache
+--SKIPIF--
+<?php if (!extension_loaded("wikidiff2")) print "skip"; ?>
+--INI--
+wikidiff2.word_cache_size=1048576
+--FILE--
+<?php
+$x = <<<EOT
+a b c
+foo
+a b c
+bar
+a b c
+EOT;
+
+#---------------------------------------------------
+
+$y = <<<EOT
+a x c
+foo
+a x c
+bar
+a x c
+EOT;
+
+#---------------------------------------------------
+
+print wikidiff2_do_diff( $x, $y, 0 );
+print_r( wikidiff2_word_cache_stats() );
+
+?>
+--EXPECT--
+<tr>
+  <td colspan="2" class="diff-lineno"><!--LINE 1--></td>
+  <td colspan="2" class="diff-lineno"><!--LINE 1--></td>
+</tr>
+<tr>
+  <td class="diff-marker">−</td>
+  <td class="diff-deletedline"><div>a <del class="diffchange diffchange-inline">b</del> c</div></td>
+  <td class="diff-marker">+</td>
+  <td class="diff-addedline"><div>a <ins class="diffchange diffchange-inline">x</ins> c</div></td>
+</tr>
+<tr>
+  <td class="diff-marker">−</td>
+  <td class="diff-deletedline"><div>a <del class="diffchange diffchange-inline">b</del> c</div></td>
+  <td class="diff-marker">+</td>
+  <td class="diff-addedline"><div>a <ins class="diffchange diffchange-inline">x</ins> c</div></td>
+</tr>
+<tr>
+  <td class="diff-marker">−</td>
+  <td class="diff-deletedline"><div>a <del class="diffchange diffchange-inline">b</del> c</div></td>
+  <td class="diff-marker">+</td>
+  <td class="diff-addedline"><div>a <ins class="diffchange diffchange-inline">x</ins> c</div></td>
+</tr>
+Array
+(
+    [hits] => 2
+    [misses] => 1
+)
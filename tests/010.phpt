@@ -0,0 +1,62 @@
+--TEST--
+Diff test J: result cache
+--SKIPIF--
+<?php if (!extension_loaded("wikidiff2")) print "skip"; ?>
+--INI--
+wikidiff2.result_cache_size=1048576
+--FILE--
+<?php
+$x = <<<EOT
+foo bar
+baz
+EOT;
+
+#---------------------------------------------------
+
+$y = <<<EOT
+foo baz
+baz
+EOT;
+
+#---------------------------------------------------
+
+$first = wikidiff2_do_diff( $x, $y, 2 );
+print_r( wikidiff2_result_cache_stats() );
+$second = wikidiff2_do_diff( $x, $y, 2 );
+print_r( wikidiff2_result_cache_stats() );
+var_dump( $first === $second );
+print $second;
+print wikidiff2_inline_diff( $x, $y, 2 );
+
+?>
+--EXPECT--
+Array
+(
+    [hits] => 0
+    [misses] => 1
+)
+Array
+(
+    [hits] => 1
+    [misses] => 1
+)
+bool(true)
+<tr>
+  <td colspan="2" class="diff-lineno"><!--LINE 1--></td>
+  <td colspan="2" class="diff-lineno"><!--LINE 1--></td>
+</tr>
+<tr>
+  <td class="diff-marker">−</td>
+  <td class="diff-deletedline"><div>foo <del class="diffchange diffchange-inline">bar</del></div></td>
+  <td class="diff-marker">+</td>
+  <td class="diff-addedline"><div>foo <ins class="diffchange diffchange-inline">baz</ins></div></td>
+</tr>
+<tr>
+  <td class="diff-marker">&#160;</td>
+  <td class="diff-context"><div>baz</div></td>
+  <td class="diff-marker">&#160;</td>
+  <td class="diff-context"><div>baz</div></td>
+</tr>
+<div class="mw-diff-inline-header"><!-- LINES 1,1 --></div>
+<div class="mw-diff-inline-changed">foo <del>bar</del><ins>baz</ins></div>
+<div class="mw-diff-inline-context">baz</div>
@@ -0,0 +1,74 @@
+--TEST--
+Diff test K: moved paragraphs
+--SKIPIF--
+<?php if (!extension_loaded("wikidiff2")) print "skip"; ?>
+--INI--
+wikidiff2.detect_moves=1
+--FILE--
+<?php
+$x = <<<EOT
+Paragraph one is about the history of the town and its founding in 1820.
+
+Paragraph two describes the geography, with rivers, hills and a lake.
+
+Paragraph three covers the economy, mostly farming and some tourism.
+EOT;
+
+#---------------------------------------------------
+
+$y = <<<EOT
+Paragraph three covers the local economy, mostly farming and some tourism.
+
+Paragraph one is about the history of the town and its founding in 1820.
+
+Paragraph two describes the geography, with rivers, hills and a lake.
+EOT;
+
+#---------------------------------------------------
+
+print wikidiff2_do_diff( $x, $y, 2 );
+
+?>
+--EXPECT--
+<tr>
+  <td colspan="2" class="diff-lineno"><!--LINE 1--></td>
+  <td colspan="2" class="diff-lineno"><!--LINE 1--></td>
+</tr>
+<tr>
+  <td colspan="2" class="diff-empty">&#160;</td>
+  <td class="diff-marker"><a class="mw-diff-movedpara-right" href="#movedpara_5_1_lhs">&#x26AB;</a></td>
+  <td class="diff-addedline"><div><a name="movedpara_5_1_rhs"></a>Paragraph three covers the<ins class="diffchange diffchange-inline"> local</ins> economy, mostly farming and some tourism.</div></td>
+</tr>
+<tr>
+  <td colspan="2" class="diff-empty">&#160;</td>
+  <td class="diff-marker">+</td>
+  <td class="diff-addedline"></td>
+</tr>
+<tr>
+  <td class="diff-marker">&#160;</td>
+  <td class="diff-context"><div>Paragraph one is about the history of the town and its founding in 1820.</div></td>
+  <td class="diff-marker">&#160;</td>
+  <td class="diff-context"><div>Paragraph one is about the history of the town and its founding in 1820.</div></td>
+</tr>
+<tr>
+  <td class="diff-marker">&#160;</td>
+  <td class="diff-context"></td>
+  <td class="diff-marker">&#160;</td>
+  <td class="diff-context"></td>
+</tr>
+<tr>
+  <td class="diff-marker">&#160;</td>
+  <td class="diff-context"><div>Paragraph two describes the geography, with rivers, hills and a lake.</div></td>
+  <td class="diff-marker">&#160;</td>
+  <td class="diff-context"><div>Paragraph two describes the geography, with rivers, hills and a lake.</div></td>
+</tr>
+<tr>
+  <td class="diff-marker">−</td>
+  <td class="diff-deletedline"></td>
+  <td colspan="2" class="diff-empty">&#160;</td>
+</tr>
+<tr>
+  <td class="diff-marker"><a class="mw-diff-movedpara-left" href="#movedpara_5_1_rhs">&#x26AB;</a></td>
+  <td class="diff-deletedline"><div><a name="movedpara_5_1_lhs"></a>Paragraph three covers the economy, mostly farming and some tourism.</div></td>
+  <td colspan="2" class="diff-empty">&#160;</td>
+</tr>
@@ -0,0 +1,70 @@
+--TEST--
+Diff test L: line pairing in a change
+--SKIPIF--
+<?php if (!extension_loaded("wikidiff2")) print "skip"; ?>
+--FILE--
+<?php
+$x = <<<EOT
+Intro line.
+The quick brown fox jumps over the lazy dog.
+Pack my box with five dozen liquor jugs.
+How vexingly quick daft zebras jump.
+Outro line.
+EOT;
+
+#---------------------------------------------------
+
+$y = <<<EOT
+Intro line.
+A completely new sentence was added here.
+The quick brown fox jumped over the lazy dog.
+Pack my box with six dozen liquor jugs.
+How vexingly quick daft zebras jump!
+Outro line.
+EOT;
+
+#---------------------------------------------------
+
+print wikidiff2_do_diff( $x, $y, 2 );
+
+?>
+--EXPECT--
+<tr>
+  <td colspan="2" class="diff-lineno"><!--LINE 1--></td>
+  <td colspan="2" class="diff-lineno"><!--LINE 1--></td>
+</tr>
+<tr>
+  <td class="diff-marker">&#160;</td>
+  <td class="diff-context"><div>Intro line.</div></td>
+  <td class="diff-marker">&#160;</td>
+  <td class="diff-context"><div>Intro line.</div></td>
+</tr>
+<tr>
+  <td colspan="2" class="diff-empty">&#160;</td>
+  <td class="diff-marker">+</td>
+  <td class="diff-addedline"><div>A completely new sentence was added here.</div></td>
+</tr>
+<tr>
+  <td class="diff-marker">−</td>
+  <td class="diff-deletedline"><div>The quick brown fox <del class="diffchange diffchange-inline">jumps</del> over the lazy dog.</div></td>
+  <td class="diff-marker">+</td>
+  <td class="diff-addedline"><div>The quick brown fox <ins class="diffchange diffchange-inline">jumped</ins> over the lazy dog.</div></td>
+</tr>
+<tr>
+  <td class="diff-marker">−</td>
+  <td class="diff-deletedline"><div>Pack my box with <del class="diffchange diffchange-inline">five</del> dozen liquor jugs.</div></td>
+  <td class="diff-marker">+</td>
+  <td class="diff-addedline"><div>Pack my box with <ins class="diffchange diffchange-inline">six</ins> dozen liquor jugs.</div></td>
+</tr>
+<tr>
+  <td class="diff-marker">−</td>
+  <td class="diff-deletedline"><div>How vexingly quick daft zebras jump<del class="diffchange diffchange-inline">.</del></div></td>
+  <td class="diff-marker">+</td>
+  <td class="diff-addedline"><div>How vexingly quick daft zebras jump<ins class="diffchange diffchange-inline">!</ins></div></td>
+</tr>
+<tr>
+  <td class="diff-marker">&#160;</td>
+  <td class="diff-context"><div>Outro line.</div></td>
+  <td class="diff-marker">&#160;</td>
+  <td class="diff-context"><div>Outro line.</div></td>
+</tr>
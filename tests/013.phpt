@@ -0,0 +1,63 @@
+--TEST--
+Diff test M: batch diffs
+--SKIPIF--
+<?php if (!extension_loaded("wikidiff2")) print "skip"; ?>
+--FILE--
+<?php
+$r1 = "First line.\nSecond line.\nThird line.";
+$r2 = "First line.\nSecond line, edited.\nThird line.";
+$r3 = "First line.\nSecond line, edited.\nThird line.\nFourth line.";
+
+#---------------------------------------------------
+
+$pairs = array( array( $r1, $r2 ), array( $r2, $r3 ) );
+print implode( '', wikidiff2_batch_diff( $pairs, array( 'numContextLines' => 1 ) ) );
+print implode( '', wikidiff2_batch_diff( $pairs,
+	array( 'format' => 'inline', 'numContextLines' => 1 ) ) );
+
+?>
+--EXPECT--
+<tr>
+  <td colspan="2" class="diff-lineno"><!--LINE 1--></td>
+  <td colspan="2" class="diff-lineno"><!--LINE 1--></td>
+</tr>
+<tr>
+  <td class="diff-marker">&#160;</td>
+  <td class="diff-context"><div>First line.</div></td>
+  <td class="diff-marker">&#160;</td>
+  <td class="diff-context"><div>First line.</div></td>
+</tr>
+<tr>
+  <td class="diff-marker">−</td>
+  <td class="diff-deletedline"><div>Second line.</div></td>
+  <td class="diff-marker">+</td>
+  <td class="diff-addedline"><div>Second line<ins class="diffchange diffchange-inline">, edited</ins>.</div></td>
+</tr>
+<tr>
+  <td class="diff-marker">&#160;</td>
+  <td class="diff-context"><div>Third line.</div></td>
+  <td class="diff-marker">&#160;</td>
+  <td class="diff-context"><div>Third line.</div></td>
+</tr>
+<tr>
+  <td colspan="2" class="diff-lineno"><!--LINE 3--></td>
+  <td colspan="2" class="diff-lineno"><!--LINE 3--></td>
+</tr>
+<tr>
+  <td class="diff-marker">&#160;</td>
+  <td class="diff-context"><div>Third line.</div></td>
+  <td class="diff-marker">&#160;</td>
+  <td class="diff-context"><div>Third line.</div></td>
+</tr>
+<tr>
+  <td colspan="2" class="diff-empty">&#160;</td>
+  <td class="diff-marker">+</td>
+  <td class="diff-addedline"><div>Fourth line.</div></td>
+</tr>
+<div class="mw-diff-inline-header"><!-- LINES 1,1 --></div>
+<div class="mw-diff-inline-context">First line.</div>
+<div class="mw-diff-inline-changed">Second line<ins>, edited</ins>.</div>
+<div class="mw-diff-inline-context">Third line.</div>
+<div class="mw-diff-inline-header"><!-- LINES 3,3 --></div>
+<div class="mw-diff-inline-context">Third line.</div>
+<div class="mw-diff-inline-added"><ins>Fourth line.</ins></div>
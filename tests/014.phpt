@@ -0,0 +1,27 @@
+--TEST--
+Diff test N: blame
+--SKIPIF--
+<?php if (!extension_loaded("wikidiff2")) print "skip"; ?>
+--FILE--
+<?php
+$revisions = array(
+	"The cat sat.\nOn the mat.",
+	"The black cat sat.\nOn the mat.",
+	"Intro.\nThe black cat sat down.\nOn the mat.",
+);
+
+#---------------------------------------------------
+
+$lines = wikidiff2_blame( $revisions );
+print implode( ',', $lines['offsets'] ) . "\n";
+print implode( ',', $lines['origins'] ) . "\n";
+$words = wikidiff2_blame( $revisions, array( 'level' => 'word' ) );
+print implode( ',', $words['offsets'] ) . "\n";
+print implode( ',', $words['origins'] ) . "\n";
+
+?>
+--EXPECT--
+0,7,31
+2,2,0
+0,5,7,10,11,16,17,20,21,24,25,29,31,33,34,37,38,41
+2,2,0,1,1,0,0,0,0,2,2,0,0,0,0,0,0,0
@@ -0,0 +1,75 @@
+--TEST--
+Diff test O: diff sessions
+--SKIPIF--
+<?php if (!extension_loaded("wikidiff2")) print "skip"; ?>
+--FILE--
+<?php
+$x = <<<EOT
+== Heading ==
+The quick brown fox.
+Jumps over the lazy dog.
+
+Second paragraph.
+Last line.
+EOT;
+
+#---------------------------------------------------
+
+$y = <<<EOT
+== Heading ==
+The quick brown fox.
+Jumps over the lazy cat.
+
+Second paragraph.
+Last line.
+EOT;
+
+#---------------------------------------------------
+
+$z = <<<EOT
+== Heading ==
+The quick brown fox.
+Jumps over the lazy cat.
+
+Second paragraph, expanded.
+Last line.
+A new line.
+EOT;
+
+#---------------------------------------------------
+
+print wikidiff2_session_diff( 'edit1', $x, $y, array( 'numContextLines' => 1 ) );
+print wikidiff2_session_diff( 'edit1', $x, $z,
+	array( 'format' => 'inline', 'numContextLines' => 1 ) );
+
+?>
+--EXPECT--
+<tr>
+  <td colspan="2" class="diff-lineno"><!--LINE 2--></td>
+  <td colspan="2" class="diff-lineno"><!--LINE 2--></td>
+</tr>
+<tr>
+  <td class="diff-marker">&#160;</td>
+  <td class="diff-context"><div>The quick brown fox.</div></td>
+  <td class="diff-marker">&#160;</td>
+  <td class="diff-context"><div>The quick brown fox.</div></td>
+</tr>
+<tr>
+  <td class="diff-marker">−</td>
+  <td class="diff-deletedline"><div>Jumps over the lazy <del class="diffchange diffchange-inline">dog</del>.</div></td>
+  <td class="diff-marker">+</td>
+  <td class="diff-addedline"><div>Jumps over the lazy <ins class="diffchange diffchange-inline">cat</ins>.</div></td>
+</tr>
+<tr>
+  <td class="diff-marker">&#160;</td>
+  <td class="diff-context"></td>
+  <td class="diff-marker">&#160;</td>
+  <td class="diff-context"></td>
+</tr>
+<div class="mw-diff-inline-header"><!-- LINES 2,2 --></div>
+<div class="mw-diff-inline-context">The quick brown fox.</div>
+<div class="mw-diff-inline-changed">Jumps over the lazy <del>dog</del><ins>cat</ins>.</div>
+<div class="mw-diff-inline-context">&#160;</div>
+<div class="mw-diff-inline-changed">Second paragraph<ins>, expanded</ins>.</div>
+<div class="mw-diff-inline-context">Last line.</div>
+<div class="mw-diff-inline-added"><ins>A new line.</ins></div>
@@ -0,0 +1,103 @@
+--TEST--
+Diff test P: edit scripts
+--SKIPIF--
+<?php if (!extension_loaded("wikidiff2")) print "skip"; ?>
+--FILE--
+<?php
+$x = <<<EOT
+First line.
+Second line.
+Third line.
+EOT;
+
+#---------------------------------------------------
+
+$y = <<<EOT
+First line.
+Second line, edited.
+Third line.
+Fourth line.
+EOT;
+
+#---------------------------------------------------
+
+$script = wikidiff2_edit_script( $x, $y, 1 );
+var_dump( strlen( $script ) );
+print_r( wikidiff2_decode_edit_script( $script ) );
+
+?>
+--EXPECT--
+int(32)
+Array
+(
+    [0] => Array
+        (
+            [op] => block
+            [leftLine] => 1
+            [rightLine] => 1
+        )
+
+    [1] => Array
+        (
+            [op] => context
+            [from] => 0
+            [fromLength] => 11
+            [to] => 0
+            [toLength] => 11
+        )
+
+    [2] => Array
+        (
+            [op] => change
+            [from] => 12
+            [fromLength] => 12
+            [to] => 12
+            [toLength] => 20
+            [words] => Array
+                (
+                    [0] => Array
+                        (
+                            [op] => copy
+                            [from] => 12
+                            [fromLength] => 11
+                            [to] => 12
+                            [toLength] => 11
+                        )
+
+                    [1] => Array
+                        (
+                            [op] => add
+                            [to] => 23
+                            [toLength] => 8
+                        )
+
+                    [2] => Array
+                        (
+                            [op] => copy
+                            [from] => 23
+                            [fromLength] => 1
+                            [to] => 31
+                            [toLength] => 1
+                        )
+
+                )
+
+        )
+
+    [3] => Array
+        (
+            [op] => context
+            [from] => 25
+            [fromLength] => 11
+            [to] => 33
+            [toLength] => 11
+        )
+
+    [4] => Array
+        (
+            [op] => add
+            [to] => 45
+            [toLength] => 12
+        )
+
+)